@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <new>
+
+#include <stdlib.h>
+
+#include "mem.h"
+
+/*
+ * Counting operator new of the tools, for --stats and --mem-stats. It is
+ * linked into the programs only, so users of the library keep their own.
+ */
+
+void *operator new(size_t size)
+{
+	void *p;
+
+	mem_allocs.fetch_add(1, std::memory_order_relaxed);
+	mem_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+	mem_thread_allocs += 1;
+
+	p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
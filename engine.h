@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2016-2018 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __ENGINE_H
+#define __ENGINE_H
+
+/*
+ * The C++ engine behind git-fixes and the C interface in fixes.h. This
+ * header is not installed, its generic names are only used inside the
+ * tools and the library.
+ */
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+#include "fixes.h"
+
+struct fixes_options {
+	std::string committer;
+	bool all;
+	bool match_all;
+	bool no_group;
+	bool reverse;
+	bool stable;
+	bool no_stable;
+	bool no_blacklist;
+	std::vector<std::string> path;
+	std::vector<std::string> bl_path;
+	std::vector<std::string> domains;
+
+	/* Trailers recognized in addition to the default ones, see trailer.h */
+	std::vector<std::string> trailers;
+
+	/* Optional hook returning the heap allocations of the calling thread */
+	unsigned long (*alloc_count)(void);
+
+	fixes_options()
+		: all(true), match_all(false), no_group(false), reverse(true),
+		  stable(true), no_stable(true), no_blacklist(false),
+		  alloc_count(NULL)
+	{ }
+};
+
+struct fixes_stats {
+	unsigned long count;
+	unsigned long match;
+	unsigned long walk_allocs;
+	unsigned long nomatch_allocs;
+	unsigned long stable;		// Fixes skipped as backported to stable
+};
+
+struct commit {
+	std::string subject;
+	std::string context;
+	std::string id;
+	std::string path;
+	bool stable;
+	bool by_subject;	// The Fixes: id did not resolve, its subject matched
+
+	commit() : stable(false), by_subject(false) { };
+};
+
+struct match_info {
+	std::string commit_id;
+	std::string committer;
+	std::string path;
+
+	bool operator<(const struct match_info &i) const
+	{
+		return commit_id < i.commit_id;
+	}
+};
+
+struct commit_scratch;
+class git_who;
+class trailer_matcher;
+
+using fixes_results = std::map<std::string, std::vector<struct commit> >;
+
+/*
+ * Everything a walk changes. The engine itself is only read by run(), so
+ * that several threads can walk different repositories at the same time
+ * against one loaded commit-list and blacklist, each with its own run.
+ */
+struct fixes_run {
+	fixes_results results;
+	struct fixes_stats stats;
+	std::map<std::string, std::string> reverts;
+	git_pathspec *bl_pathspec;
+
+	fixes_run() : stats(), bl_pathspec(NULL) { }
+};
+
+class git_fixes {
+private:
+	struct fixes_options opts;
+	struct fixes_run last_run;
+	std::vector<struct match_info> match_list;
+	std::vector<std::string> blacklist;
+	std::unique_ptr<git_who> owner_map;
+	std::set<std::string> owner_ignore;
+	std::unique_ptr<trailer_matcher> matcher;
+	std::vector<std::string> stable_index;
+
+	/* Normalized subjects of the commit-list, built on first use */
+	mutable std::mutex subject_lock;
+	mutable std::unordered_map<std::string, std::string> subject_index;
+	mutable bool subject_index_built;
+
+	bool is_blacklisted(const char*) const;
+	bool in_stable(const char*) const;
+	std::vector<struct match_info>::const_iterator find_match(const char*) const;
+	int  match_parent_tree(git_commit*, size_t, git_diff_options*,
+			       git_pathspec*, std::set<std::string>*) const;
+	bool match_tree(git_commit*, git_diff_options*, git_pathspec*,
+			std::set<std::string>*) const;
+	std::string find_owner(const std::set<std::string>&) const;
+	bool match_commit(struct fixes_run&, struct commit_scratch&, const char*,
+			  git_commit*, git_diff_options*, bool) const;
+	void build_subject_index(git_repository*) const;
+	const std::string *match_subject(git_repository*, const char*,
+					 size_t) const;
+	void parse_line(const char*, size_t, struct commit_scratch&) const;
+	void parse_commit_msg(struct commit_scratch&, const char*) const;
+	int  handle_commit(struct fixes_run&, git_commit*, git_repository*,
+			   git_diff_options*, struct commit_scratch&) const;
+	bool init_diffopts(struct fixes_run&, git_diff_options*,
+			   std::vector<std::string>&) const;
+	void remove_reverts(struct fixes_run&) const;
+
+public:
+	git_fixes();
+	~git_fixes();
+
+	/* Fails when a trailer is invalid, the old options stay in place then */
+	bool set_options(const struct fixes_options&);
+	const struct fixes_options &get_options(void) const;
+
+	void load_commits(std::istream&);
+	void load_commits(const std::vector<struct match_info>&);
+	bool load_commit_file(const std::string&);
+	bool load_ignore_file(const std::string&);
+	bool load_blacklist_file(const std::string&);
+	bool load_path_blacklist_file(const std::string&);
+	void add_blacklist(const std::string&);
+	void load_blacklist(const std::vector<std::string>&);
+	void add_path_blacklist(const std::string&);
+	bool load_path_map(const std::string&);
+	bool load_stable_index(git_repository*, const std::string&,
+			       const std::string&);
+	bool load_owner_ignore_file(const std::string&);
+	void sanitize_blacklist(git_repository*);
+	bool write_blacklist_file(const std::string&) const;
+
+	int  run(git_repository*, const std::string&);
+
+	/* Can be called from several threads, each with its own repository */
+	int  run(git_repository*, const std::string&, struct fixes_run&) const;
+	const fixes_results &get_results(void) const;
+	const struct fixes_stats &get_stats(void) const;
+};
+
+#endif /* __ENGINE_H */
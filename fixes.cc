@@ -0,0 +1,1703 @@
+/*
+ * Copyright (c) 2016-2018 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <git2.h>
+
+#include "engine.h"
+#include "output.h"
+#include "perf.h"
+#include "mem.h"
+#include "trace.h"
+#include "trailer.h"
+#include "who.h"
+
+using namespace std;
+
+struct reference {
+	char id[41];
+	bool fixes;		// Counts as a fix of the commit
+	bool revert;
+	bool cherry_pick;
+	bool upstream;
+
+	/* Subject quoted after the id, as in Fixes: <id> ("subject") */
+	const char *subject;
+	size_t subject_len;
+};
+
+/*
+ * Scratch data for the commit currently looked at. A single instance
+ * is reused for the whole walk and only points into the commit message,
+ * so that commits which do not match cause no heap allocations. Matches
+ * get copied into a struct commit.
+ */
+struct commit_scratch {
+	char id[41];
+	const char *subject;
+	size_t subject_len;
+	bool stable;
+	bool in_stable;
+	int revert;		// Index of the reverted commit in refs, or -1
+
+	vector<struct reference> refs;
+
+	void reset()
+	{
+		subject     = "";
+		subject_len = 0;
+		stable      = false;
+		in_stable   = false;
+		revert      = -1;
+		refs.clear();
+	}
+};
+
+static bool is_hex(const string &s)
+{
+	for (string::const_iterator c = s.begin(); c != s.end(); ++c) {
+		if (!isxdigit(*c))
+			return false;
+	}
+
+	return true;
+}
+
+static string to_lower(string s)
+{
+	transform(s.begin(), s.end(), s.begin(), ::tolower);
+
+	return s;
+}
+
+static string trim(const string &line)
+{
+	static const char *spaces = " \n\t\r";
+	size_t pos1, pos2;
+
+	pos1 = line.find_first_not_of(spaces);
+	pos2 = line.find_last_not_of(spaces);
+
+	if (pos1 == string::npos)
+		return string("");
+
+	return line.substr(pos1, pos2-pos1+1);
+}
+
+static int split_trim(vector<string> &items, const char *delim,
+		      string buffer, unsigned splits)
+{
+	unsigned num;
+	string item;
+	size_t pos;
+
+	buffer = trim(buffer);
+
+	num = 0;
+	pos = 0;
+
+	while (pos != std::string::npos) {
+		pos = buffer.find_first_of(delim, 0);
+		if (pos == string::npos) {
+			item = buffer;
+		} else {
+			item   = buffer.substr(0, pos);
+			buffer = buffer.substr(pos + 1);
+		}
+
+		num += 1;
+		items.push_back(trim(item));
+
+		if (splits && num == splits)
+			break;
+	}
+
+	return num;
+}
+
+static string fix_revision(string rev)
+{
+	if (rev.length() < 2)
+		return rev;
+
+	if (rev.substr(0,2) == "..")
+		rev = "HEAD" + rev;
+
+	if (rev.substr(rev.length() - 2, 2) == "..")
+		rev = rev + "HEAD";
+
+	return rev;
+}
+
+git_fixes::git_fixes()
+	: matcher(new trailer_matcher), subject_index_built(false)
+{
+	vector<struct trailer> trailers;
+
+	git_libgit2_init();
+
+	trailer_defaults(trailers);
+	matcher->compile(trailers);
+}
+
+git_fixes::~git_fixes()
+{
+	git_libgit2_shutdown();
+}
+
+bool git_fixes::set_options(const struct fixes_options &o)
+{
+	unique_ptr<trailer_matcher> m(new trailer_matcher);
+	vector<struct trailer> trailers;
+
+	trailer_defaults(trailers);
+
+	for (auto &spec : o.trailers) {
+		struct trailer t;
+
+		if (trailer_parse(spec, t))
+			return false;
+
+		trailers.push_back(t);
+	}
+
+	if (m->compile(trailers))
+		return false;
+
+	opts    = o;
+	matcher = move(m);
+
+	return true;
+}
+
+const struct fixes_options &git_fixes::get_options(void) const
+{
+	return opts;
+}
+
+bool git_fixes::is_blacklisted(const char *commit_id) const
+{
+	vector<string>::const_iterator it;
+
+	it = lower_bound(blacklist.begin(), blacklist.end(), commit_id,
+			 [](const string &s, const char *id) {
+				return s.compare(id) < 0;
+			 });
+
+	return (it != blacklist.end() && *it == commit_id);
+}
+
+vector<struct match_info>::const_iterator git_fixes::find_match(const char *commit_id) const
+{
+	vector<struct match_info>::const_iterator it;
+
+	it = lower_bound(match_list.begin(), match_list.end(), commit_id,
+			 [](const struct match_info &m, const char *id) {
+				return m.commit_id.compare(id) < 0;
+			 });
+
+	if (it != match_list.end() && it->commit_id != commit_id)
+		it = match_list.end();
+
+	return it;
+}
+
+struct bl_match {
+	git_pathspec *pathspec;
+	bool match;
+};
+
+static int diff_file_cb(const git_diff_delta *delta, float progess, void *data)
+{
+	struct bl_match *m = (struct bl_match *)data;
+	git_pathspec_flag_t flags = GIT_PATHSPEC_USE_CASE;
+
+	if (!git_pathspec_matches_path(m->pathspec, flags, delta->old_file.path))
+		m->match = false;
+
+	if (!git_pathspec_matches_path(m->pathspec, flags, delta->new_file.path))
+		m->match = false;
+
+	return 0;
+}
+
+int git_fixes::match_parent_tree(git_commit *commit, size_t p,
+				 git_diff_options *diffopts,
+				 git_pathspec *bl_pathspec,
+				 set<string> *paths) const
+{
+	struct bl_match b_listed = { bl_pathspec, false };
+	git_commit *parent;
+	git_tree *a, *b;
+	git_diff *diff;
+	int err;
+
+	err = git_commit_parent(&parent, commit, p);
+	if (err)
+		return err;
+
+	err = git_commit_tree(&a, parent);
+	if (err)
+		goto out_free_parent;
+
+	err = git_commit_tree(&b, commit);
+	if (err)
+		goto out_free_a;
+
+	err = git_diff_tree_to_tree(&diff, git_commit_owner(commit), a, b, diffopts);
+	if (err < 0)
+		goto out_free_b;
+
+	if (bl_pathspec) {
+		b_listed.match = true;
+#if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR < 23
+		git_diff_foreach(diff, diff_file_cb, NULL, NULL, &b_listed);
+#else
+		git_diff_foreach(diff, diff_file_cb, NULL, NULL, NULL, &b_listed);
+#endif
+	}
+
+	err = git_diff_num_deltas(diff) > 0 ? 1 : 0;
+
+	// Keep the changed paths for the owner lookup
+	for (size_t i = 0; paths && i < git_diff_num_deltas(diff); ++i)
+		paths->emplace(git_diff_get_delta(diff, i)->new_file.path);
+
+	if (b_listed.match)
+		err = 0;
+
+	git_diff_free(diff);
+out_free_b:
+	git_tree_free(b);
+out_free_a:
+	git_tree_free(a);
+out_free_parent:
+	git_commit_free(parent);
+
+	return err;
+}
+
+/*
+ * When paths is not NULL, the files changed by the commit are stored
+ * there, limited to the path filter if there is one.
+ */
+bool git_fixes::match_tree(git_commit *commit, git_diff_options *diffopts,
+			   git_pathspec *bl_pathspec, set<string> *paths) const
+{
+	bool filter = diffopts->pathspec.count > 0 || bl_pathspec != NULL;
+	git_pathspec *ps = NULL;
+	unsigned int parents;
+	bool ret = false;
+	int err;
+
+	if (!filter && !paths)
+		return true;
+
+	parents = git_commit_parentcount(commit);
+
+	if (!filter && parents == 0)
+		return true;
+
+	if (parents == 0) {
+		git_tree *tree;
+
+		err = git_pathspec_new(&ps, &diffopts->pathspec);
+		if (err < 0)
+			return false;
+		err = git_commit_tree(&tree, commit);
+		if (err < 0)
+			return false;
+
+		err = git_pathspec_match_tree(NULL, tree, GIT_PATHSPEC_NO_MATCH_ERROR, ps);
+		if (!err)
+			ret = true;
+
+		git_tree_free(tree);
+		git_pathspec_free(ps);
+	} else {
+		for (unsigned i = 0; i < parents; ++i) {
+			if (match_parent_tree(commit, i, diffopts, bl_pathspec,
+					      paths) > 0) {
+				ret = true;
+				break;
+			}
+		}
+	}
+
+	return filter ? ret : true;
+}
+
+/* The best owner from the path-map, ignored people only as a last resort */
+string git_fixes::find_owner(const set<string> &paths) const
+{
+	struct people results;
+
+	owner_map->match_paths(paths, results);
+
+	for (auto &p : results.persons) {
+		if (owner_ignore.find(p.name) == owner_ignore.end())
+			return p.name;
+	}
+
+	return results.persons.empty() ? "" : results.persons.front().name;
+}
+
+static bool match_domain(const vector<string> &domains, const string &email)
+{
+	auto pos = email.find_first_of("@");
+
+	if (pos == string::npos)
+		return false;
+
+	string domain = to_lower(trim(email.substr(pos + 1)));
+
+	for (auto &d : domains) {
+		if (d == domain)
+			return true;
+	}
+
+	return false;
+}
+
+bool git_fixes::match_commit(struct fixes_run &run, struct commit_scratch &c,
+			     const char *id, git_commit *commit,
+			     git_diff_options *diffopts, bool by_subject) const
+{
+	vector<struct match_info>::const_iterator it;
+	string author, committer, context;
+	const git_signature *sig;
+	set<string> paths;
+	bool need_owner;
+	bool ret;
+
+	if ((!opts.stable    &&  c.stable) ||
+	    (!opts.no_stable && !c.stable))
+		return false;
+
+	/* First check if the commit is already in the tree */
+	if (find_match(c.id) != match_list.end())
+		return false;
+
+	it = find_match(id);
+	if (it == match_list.end())
+		return false;
+
+	/* A stable tree in the base carries it already */
+	if (in_stable(c.id)) {
+		c.in_stable = true;
+		return false;
+	}
+
+	context = it->committer;
+
+	// Load author and committer of potential fix
+	sig = git_commit_author(commit);
+	if (sig)
+		author = to_lower(sig->email);
+
+	sig = git_commit_committer(commit);
+	if (sig)
+		committer = to_lower(sig->email);
+
+	if (match_domain(opts.domains, author))
+		context = author;
+	else if (match_domain(opts.domains, committer))
+		context = committer;
+
+	if (!opts.all && opts.committer.length() > 0) {
+		if (context.find(opts.committer) == string::npos)
+			return false;
+	}
+
+	// Base and Unknown fixes have no committer to send them to
+	need_owner = owner_map && (context == "Base" || context == "Unknown");
+
+	{
+		trace_span span("match_tree");
+
+		ret = match_tree(commit, diffopts, run.bl_pathspec,
+				 need_owner ? &paths : NULL);
+	}
+
+	if (ret && need_owner) {
+		string owner = find_owner(paths);
+
+		if (owner != "")
+			context = owner;
+	}
+
+	if (ret) {
+		struct commit __commit;
+		string key = opts.no_group ? "default" : context;
+
+		// Kept apart, these matches are less certain
+		if (by_subject && !opts.no_group)
+			key += " (matched by subject)";
+
+		__commit.subject.assign(c.subject, c.subject_len);
+		__commit.id      = c.id;
+		__commit.stable  = c.stable;
+		__commit.by_subject = by_subject;
+		__commit.context = context;
+		__commit.path    = it->path;
+		run.results[key].emplace_back(__commit);
+	}
+
+	return ret;
+}
+
+static bool isdelim(int c)
+{
+	return isblank(c) || c == ':';
+}
+
+static void set_kind(struct reference &ref, enum trailer_kind kind)
+{
+	switch (kind) {
+	case TRAILER_FIXES:
+		ref.fixes = true;
+		break;
+	case TRAILER_REVERT:
+		ref.fixes  = true;
+		ref.revert = true;
+		break;
+	case TRAILER_CHERRY_PICK:
+		ref.cherry_pick = true;
+		break;
+	case TRAILER_UPSTREAM:
+		ref.upstream = true;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Checks for the commit-id of a trailer with %H at pos and the suffix
+ * after it. Reverts are only recognized with a full commit-id, which is
+ * what remove_reverts() compares against.
+ */
+static bool trailer_id(const struct trailer &t, const char *line, size_t len,
+		       size_t pos, struct reference &ref)
+{
+	size_t id_len = 0;
+
+	while (pos + id_len < len && id_len <= 40 && isxdigit(line[pos + id_len]))
+		id_len += 1;
+
+	if (id_len < 8 || id_len > 40 || (t.kind == TRAILER_REVERT && id_len != 40))
+		return false;
+
+	if (len - pos - id_len < t.suffix.size() ||
+	    strncasecmp(line + pos + id_len, t.suffix.c_str(), t.suffix.size()))
+		return false;
+
+	if (t.suffix != "" && pos + id_len + t.suffix.size() != len)
+		return false;
+
+	memcpy(ref.id, line + pos, id_len);
+	ref.id[id_len] = 0;
+
+	return true;
+}
+
+/* Finds the subject in Fixes: <id> ("subject") */
+static void quoted_subject(const char *line, size_t len, struct reference &ref)
+{
+	const char *start, *end;
+
+	start = (const char *)memmem(line, len, "(\"", 2);
+	if (!start)
+		return;
+
+	start += 2;
+
+	for (end = line + len - 2; end >= start; --end) {
+		if (end[0] == '"' && end[1] == ')') {
+			ref.subject     = start;
+			ref.subject_len = end - start;
+			return;
+		}
+	}
+}
+
+void git_fixes::parse_line(const char *line, size_t len,
+			   struct commit_scratch &cm) const
+{
+	struct trailer_hit hits[8];
+	bool found_commit = false;
+	struct reference commit;
+	size_t id_len = 0;
+	int last_c = -1;
+	unsigned nr;
+
+	memset(&commit, 0, sizeof(commit));
+
+	nr = matcher->match(line, len, hits, 8);
+
+	for (unsigned i = 0; i < nr; ++i) {
+		const struct trailer &t = matcher->get(hits[i].idx);
+
+		if (t.kind == TRAILER_STABLE) {
+			cm.stable = true;
+			continue;
+		}
+
+		if (!t.has_id) {
+			set_kind(commit, t.kind);
+			if (commit.fixes)
+				quoted_subject(line, len, commit);
+			continue;
+		}
+
+		// A trailer with its own commit-id is the only one on the line
+		if (!trailer_id(t, line, len, hits[i].end, commit))
+			continue;
+
+		set_kind(commit, t.kind);
+		if (commit.revert)
+			cm.revert = cm.refs.size();
+		cm.refs.push_back(commit);
+		return;
+	}
+
+	for (size_t i = 0; i < len; last_c = line[i], ++i) {
+		int c = line[i];
+		bool hex = isxdigit(c);
+
+		if (isdelim(last_c) && hex) {
+			found_commit = true;
+		}
+
+		if (found_commit && hex) {
+			if (id_len < 40)
+				commit.id[id_len] = c;
+			id_len += 1;
+		}
+
+		if (found_commit && (isdelim(c) || i + 1 == len)) {
+			if (id_len >= 8 && id_len <= 40) {
+				commit.id[id_len] = 0;
+				cm.refs.push_back(commit);
+			}
+		}
+
+		if (found_commit && !hex) {
+			found_commit = false;
+			id_len = 0;
+		}
+	}
+}
+
+void git_fixes::parse_commit_msg(struct commit_scratch &commit,
+				 const char *msg) const
+{
+	static const char *spaces = " \n\t\r";
+	const char *line = msg;
+	bool first = true;
+
+	while (*line) {
+		const char *end = strchrnul(line, '\n');
+		const char *next = *end ? end + 1 : end;
+
+		while (line < end && strchr(spaces, *line))
+			line += 1;
+		while (end > line && strchr(spaces, end[-1]))
+			end -= 1;
+
+		/* Leading empty lines are not part of the subject */
+		if (first && line == end) {
+			line = next;
+			continue;
+		}
+
+		if (first) {
+			commit.subject     = line;
+			commit.subject_len = end - line;
+			first = false;
+		}
+
+		parse_line(line, end - line, commit);
+
+		line = next;
+	}
+}
+
+int git_fixes::handle_commit(struct fixes_run &run, git_commit *commit,
+			     git_repository *repo, git_diff_options *diffopts,
+			     struct commit_scratch &c) const
+{
+	const git_oid *oid;
+	const char *msg;
+	int error;
+
+	oid = git_commit_id(commit);
+
+	git_oid_fmt(c.id, oid);
+	c.id[40] = 0;
+
+	if (!opts.no_blacklist && is_blacklisted(c.id))
+		return 0;
+
+	/* Ignore merge and root commits */
+	if (git_commit_parentcount(commit) != 1)
+		return 0;
+
+	msg = git_commit_message(commit);
+	c.reset();
+	parse_commit_msg(c, msg);
+
+	if (c.revert >= 0)
+		run.reverts[c.id] = c.refs[c.revert].id;
+
+	error = 0;
+	for (auto &ref : c.refs) {
+		bool by_subject = false;
+		git_object *obj;
+		char id[41];
+
+		if (!opts.match_all && !ref.fixes)
+			continue;
+
+		if (git_revparse_single(&obj, repo, ref.id) < 0) {
+			const string *sid;
+
+			// Ids of rebased trees may still quote the right subject
+			if (!ref.fixes || !ref.subject_len)
+				continue;
+
+			sid = match_subject(repo, ref.subject, ref.subject_len);
+			if (!sid)
+				continue;
+
+			strcpy(id, sid->c_str());
+			by_subject = true;
+		} else {
+			git_oid_tostr(id, sizeof(id), git_object_id(obj));
+
+			git_object_free(obj);
+		}
+
+		if (match_commit(run, c, id, commit, diffopts, by_subject)) {
+			error = 1;
+			break;
+		}
+	}
+
+	if (c.in_stable)
+		run.stats.stable += 1;
+
+	return error;
+}
+
+void git_fixes::load_commits(istream &in)
+{
+	trace_span span("load_commits");
+	string line;
+
+	while (getline(in, line)) {
+		struct match_info info;
+		vector<string> tokens;
+		int num;
+
+		num = split_trim(tokens, ",", line, 3);
+
+		if (!num)
+			continue;
+
+		info.commit_id = to_lower(tokens[0]);
+		if (num > 1)
+			info.committer = tokens[1];
+		if (num > 2)
+			info.path      = tokens[2];
+
+		match_list.emplace_back(info);
+	}
+
+	sort(match_list.begin(), match_list.end());
+	subject_index_built = false;
+}
+
+void git_fixes::load_commits(const vector<struct match_info> &commits)
+{
+	trace_span span("load_commits");
+	for (auto &info : commits) {
+		match_list.emplace_back(info);
+		match_list.back().commit_id = to_lower(info.commit_id);
+	}
+
+	sort(match_list.begin(), match_list.end());
+	subject_index_built = false;
+}
+
+bool git_fixes::load_ignore_file(const string &filename)
+{
+	trace_span span("load_ignore_file");
+	ifstream file;
+	string line;
+
+	if (filename == "")
+		return true;
+
+	file.open(filename.c_str());
+	if (!file.is_open())
+		return false;
+
+	while (getline(file, line)) {
+		vector<string> tokens;
+
+		if (!split_trim(tokens, ",", line, 1))
+			continue;
+
+		blacklist.push_back(to_lower(tokens[0]));
+	}
+
+	sort(blacklist.begin(), blacklist.end());
+
+	return true;
+}
+
+bool git_fixes::load_commit_file(const string &filename)
+{
+	ifstream file;
+	istream *in;
+
+	if (filename == "") {
+		return false;
+	} else if (filename == "-") {
+		in = &cin;
+	} else {
+		file.open(filename.c_str());
+		if (!file.is_open())
+			return false;
+
+		in = &file;
+	}
+
+	load_commits(*in);
+
+	if (file.is_open())
+		file.close();
+
+	return true;
+}
+
+bool git_fixes::load_blacklist_file(const string &filename)
+{
+	trace_span span("load_blacklist");
+	ifstream file;
+	string line;
+
+	if (filename == "")
+		return true;
+
+	file.open(filename.c_str());
+
+	if (!file.is_open())
+		return false;
+
+	while (getline(file, line)) {
+		line = to_lower(trim(line));
+		if (!is_hex(line))
+			continue;
+
+		blacklist.push_back(line);
+	}
+
+	file.close();
+
+	sort(blacklist.begin(), blacklist.end());
+
+	return true;
+}
+
+bool git_fixes::load_path_blacklist_file(const string &filename)
+{
+	trace_span span("load_path_blacklist");
+	ifstream file;
+
+	if (filename == "")
+		return true;
+
+	file.open(filename.c_str());
+
+	if (!file.is_open())
+		return false;
+
+	while (!file.eof()) {
+		string line;
+
+		getline(file, line);
+
+		auto pos = line.find_first_of("#");
+		if (pos != string::npos)
+			line = line.substr(0, pos);
+
+		line = trim(line);
+
+		if (line != "")
+			opts.bl_path.emplace_back(line);
+	}
+
+	file.close();
+
+	return true;
+}
+
+bool git_fixes::load_path_map(const string &filename)
+{
+	unique_ptr<git_who> who(new git_who);
+
+	if (who->load_path_map(filename))
+		return false;
+
+	owner_map = std::move(who);
+
+	return true;
+}
+
+/* Same format as the ignore-lists of git-who, one email per line */
+bool git_fixes::load_owner_ignore_file(const string &filename)
+{
+	ifstream file;
+	string line;
+
+	if (filename == "")
+		return true;
+
+	file.open(filename.c_str());
+	if (!file.is_open())
+		return false;
+
+	while (getline(file, line)) {
+		auto pos = line.find_first_of("#");
+		if (pos != string::npos)
+			line = line.substr(0, pos);
+
+		line = trim(line);
+
+		if (line != "")
+			owner_ignore.emplace(line);
+	}
+
+	file.close();
+
+	return true;
+}
+
+/*
+ * The stable-index cache has a "range <bottom> <tip>" line for every range
+ * bottom (- when there is none), followed by the upstream ids found up to
+ * that tip, one per line.
+ */
+static const char *stable_cache_magic = "# git-fixes stable-index v1";
+
+struct stable_entry {
+	string tip;
+	vector<string> ids;
+};
+
+static void load_stable_cache(const string &filename,
+			      map<string, struct stable_entry> &cache)
+{
+	struct stable_entry *entry = NULL;
+	ifstream file;
+	string line;
+
+	if (filename == "")
+		return;
+
+	file.open(filename.c_str());
+	if (!file.is_open())
+		return;
+
+	if (!getline(file, line) || line != stable_cache_magic)
+		return;
+
+	while (getline(file, line)) {
+		vector<string> tokens;
+
+		if (line.compare(0, 6, "range ")) {
+			if (entry && line.length() == 40)
+				entry->ids.emplace_back(line);
+			continue;
+		}
+
+		if (split_trim(tokens, " ", line, 0) != 3) {
+			entry = NULL;
+			continue;
+		}
+
+		entry = &cache[tokens[1]];
+		entry->tip = tokens[2];
+		entry->ids.clear();
+	}
+}
+
+static void mkdir_p(const string &dir)
+{
+	for (size_t pos = dir.find('/', 1); pos != string::npos;
+	     pos = dir.find('/', pos + 1))
+		mkdir(dir.substr(0, pos).c_str(), 0755);
+
+	mkdir(dir.c_str(), 0755);
+}
+
+static void save_stable_cache(const string &filename,
+			      const map<string, struct stable_entry> &cache)
+{
+	output_file file;
+
+	auto pos = filename.find_last_of("/");
+	if (pos != string::npos)
+		mkdir_p(filename.substr(0, pos));
+
+	if (file.open(filename)) {
+		fprintf(stderr, "Can't write stable-index %s\n", filename.c_str());
+		return;
+	}
+
+	file << stable_cache_magic << '\n';
+
+	for (auto &e : cache) {
+		file << "range " << e.first << ' ' << e.second.tip << '\n';
+
+		for (auto &id : e.second.ids)
+			file << id << '\n';
+	}
+
+	if (file.commit())
+		fprintf(stderr, "Can't write stable-index %s\n", filename.c_str());
+}
+
+static int peel_commit(git_oid *oid, git_object *obj)
+{
+	git_object *commit;
+	int err;
+
+	err = git_object_peel(&commit, obj, GIT_OBJ_COMMIT);
+	if (err)
+		return err;
+
+	git_oid_cpy(oid, git_object_id(commit));
+	git_object_free(commit);
+
+	return 0;
+}
+
+/*
+ * Collects the upstream ids of the stable backports in range. A cached
+ * index for the same bottom is extended when the new tip descends from
+ * the cached one, so only the new stable commits get scanned.
+ */
+bool git_fixes::load_stable_index(git_repository *repo, const string &range,
+				  const string &cache_file)
+{
+	trace_span span("load_stable_index");
+	map<string, struct stable_entry> cache;
+	struct stable_entry *entry;
+	struct commit_scratch scratch;
+	string bottom = "-", tip;
+	git_oid tip_oid, oid;
+	char buf[41];
+	git_revwalk *walker = NULL;
+	git_revspec spec;
+	bool reuse = false;
+	size_t nr_ids;
+	int err;
+
+	if (git_revparse(&spec, repo, range.c_str())) {
+		fprintf(stderr, "Can't parse stable range: %s\n", range.c_str());
+		return false;
+	}
+
+	if (spec.flags & GIT_REVPARSE_MERGE_BASE) {
+		git_object_free(spec.to);
+		git_object_free(spec.from);
+		fprintf(stderr, "Can't parse stable range: %s\n", range.c_str());
+		return false;
+	}
+
+	if (spec.flags & GIT_REVPARSE_SINGLE) {
+		err = peel_commit(&tip_oid, spec.from);
+	} else {
+		err = peel_commit(&tip_oid, spec.to);
+		if (!err)
+			err = peel_commit(&oid, spec.from);
+		if (!err)
+			bottom = git_oid_tostr(buf, sizeof(buf), &oid);
+		git_object_free(spec.to);
+	}
+
+	git_object_free(spec.from);
+
+	if (err) {
+		fprintf(stderr, "Can't parse stable range: %s\n", range.c_str());
+		return false;
+	}
+
+	tip = git_oid_tostr(buf, sizeof(buf), &tip_oid);
+
+	load_stable_cache(cache_file, cache);
+
+	entry = &cache[bottom];
+
+	if (entry->tip != "" && !git_oid_fromstr(&oid, entry->tip.c_str()))
+		reuse = git_oid_equal(&oid, &tip_oid) ||
+			git_graph_descendant_of(repo, &tip_oid, &oid) == 1;
+
+	if (!reuse)
+		entry->ids.clear();
+
+	nr_ids = entry->ids.size();
+
+	err = git_revwalk_new(&walker, repo);
+	if (err)
+		goto out;
+
+	git_revwalk_push(walker, &tip_oid);
+
+	if (bottom != "-" && !git_oid_fromstr(&oid, bottom.c_str()))
+		git_revwalk_hide(walker, &oid);
+
+	if (reuse && !git_oid_fromstr(&oid, entry->tip.c_str()))
+		git_revwalk_hide(walker, &oid);
+
+	while (!git_revwalk_next(&oid, walker)) {
+		git_commit *commit;
+
+		if (git_commit_lookup(&commit, repo, &oid))
+			continue;
+
+		git_oid_fmt(scratch.id, &oid);
+		scratch.id[40] = 0;
+		scratch.reset();
+
+		parse_commit_msg(scratch, git_commit_message(commit));
+
+		for (auto &ref : scratch.refs) {
+			if (ref.upstream && strlen(ref.id) == 40)
+				entry->ids.emplace_back(to_lower(ref.id));
+		}
+
+		git_commit_free(commit);
+	}
+
+	git_revwalk_free(walker);
+
+	if (cache_file != "" && (entry->tip != tip || entry->ids.size() != nr_ids)) {
+		entry->tip = tip;
+		save_stable_cache(cache_file, cache);
+	}
+
+	stable_index.insert(stable_index.end(), entry->ids.begin(),
+			    entry->ids.end());
+	sort(stable_index.begin(), stable_index.end());
+	stable_index.erase(unique(stable_index.begin(), stable_index.end()),
+			   stable_index.end());
+
+out:
+	return err == 0;
+}
+
+/* Lower case, with runs of white-space collapsed to one blank */
+static string normalize_subject(const char *s, size_t len)
+{
+	string ret;
+	bool blank = false;
+
+	for (size_t i = 0; i < len; ++i) {
+		if (isspace(s[i])) {
+			blank = !ret.empty();
+			continue;
+		}
+
+		if (blank)
+			ret += ' ';
+
+		ret  += tolower(s[i]);
+		blank = false;
+	}
+
+	return ret;
+}
+
+/*
+ * Maps the subjects of the commit-list to their ids. Subjects shared by
+ * more than one commit map to an empty id and never match.
+ */
+void git_fixes::build_subject_index(git_repository *repo) const
+{
+	trace_span span("build_subject_index");
+
+	subject_index.clear();
+	subject_index_built = true;
+
+	for (auto &m : match_list) {
+		git_commit *commit;
+		const char *summary;
+		git_oid oid;
+
+		if (m.commit_id.length() != 40 ||
+		    git_oid_fromstr(&oid, m.commit_id.c_str()) ||
+		    git_commit_lookup(&commit, repo, &oid))
+			continue;
+
+		summary = git_commit_summary(commit);
+		if (summary) {
+			string key = normalize_subject(summary, strlen(summary));
+			auto r = subject_index.emplace(key, m.commit_id);
+
+			if (!r.second && r.first->second != m.commit_id)
+				r.first->second = "";
+		}
+
+		git_commit_free(commit);
+	}
+}
+
+/*
+ * The index is shared by all runs, the first one that needs it builds it
+ * while the others wait. Entries stay in place until the commit-list
+ * changes.
+ */
+const string *git_fixes::match_subject(git_repository *repo,
+				       const char *subject, size_t len) const
+{
+	lock_guard<mutex> guard(subject_lock);
+
+	// Built on first use, most runs never need it
+	if (!subject_index_built)
+		build_subject_index(repo);
+
+	auto it = subject_index.find(normalize_subject(subject, len));
+	if (it == subject_index.end() || it->second == "")
+		return NULL;
+
+	return &it->second;
+}
+
+bool git_fixes::in_stable(const char *commit_id) const
+{
+	auto it = lower_bound(stable_index.begin(), stable_index.end(), commit_id,
+			      [](const string &s, const char *id) {
+				      return s.compare(id) < 0;
+			      });
+
+	return it != stable_index.end() && *it == commit_id;
+}
+
+void git_fixes::add_blacklist(const string &commit_id)
+{
+	string id = to_lower(commit_id);
+
+	if (is_hex(id))
+		blacklist.push_back(id);
+}
+
+void git_fixes::load_blacklist(const vector<string> &ids)
+{
+	for (auto &commit_id : ids) {
+		string id = to_lower(commit_id);
+
+		if (is_hex(id))
+			blacklist.push_back(id);
+	}
+
+	sort(blacklist.begin(), blacklist.end());
+}
+
+void git_fixes::add_path_blacklist(const string &path)
+{
+	opts.bl_path.emplace_back(path);
+}
+
+bool git_fixes::write_blacklist_file(const string &filename) const
+{
+	output_file file;
+
+	if (file.open(filename))
+		return false;
+
+	for (vector<string>::const_iterator it = blacklist.begin();
+	     it != blacklist.end();
+	     ++it)
+		file << *it << '\n';
+
+	return file.commit() == 0;
+}
+
+void git_fixes::sanitize_blacklist(git_repository *repo)
+{
+	vector<string> old_blacklist = blacklist;
+
+	blacklist.clear();
+
+	for (vector<string>::iterator it = old_blacklist.begin();
+	     it != old_blacklist.end();
+	     ++it) {
+		git_object *obj;
+		int error;
+
+		error = git_revparse_single(&obj, repo, it->c_str());
+		if (error) {
+			fprintf(stderr, "Blacklisted commit %s can't be found - removing\n",
+				it->c_str());
+			continue;
+		}
+
+		blacklist.push_back(git_oid_tostr_s(git_object_id(obj)));
+
+		git_object_free(obj);
+	}
+}
+
+static int revwalk_init(git_revwalk **walker, git_repository *repo,
+			const char *revision)
+{
+	trace_span span("revwalk_init");
+	perf_phase phase("revwalk_init");
+	mem_phase mphase("revwalk_init");
+	git_revspec spec;
+	int err;
+
+	err = git_revwalk_new(walker, repo);
+	if (err)
+		return err;
+
+	err = git_revparse(&spec, repo, revision);
+	if (err)
+		goto out_free;
+
+	if (spec.flags & GIT_REVPARSE_SINGLE) {
+		git_revwalk_push(*walker, git_object_id(spec.from));
+		git_object_free(spec.from);
+	} else if (spec.flags & GIT_REVPARSE_RANGE) {
+		git_revwalk_push(*walker, git_object_id(spec.to));
+
+		if (spec.flags & GIT_REVPARSE_MERGE_BASE) {
+			git_oid base;
+			err = git_merge_base(&base, repo,
+					     git_object_id(spec.from),
+					     git_object_id(spec.to));
+			if (err) {
+				git_object_free(spec.to);
+				git_object_free(spec.from);
+				goto out_free;
+			}
+
+			git_revwalk_push(*walker, &base);
+		}
+
+		git_revwalk_hide(*walker, git_object_id(spec.from));
+		git_object_free(spec.to);
+		git_object_free(spec.from);
+	}
+
+	return 0;
+
+out_free:
+	git_revwalk_free(*walker);
+
+	return err;
+}
+
+static void destroy_diffopts(git_diff_options *diffopts)
+{
+	if (!diffopts->pathspec.strings)
+		return;
+
+	for (unsigned i = 0; i < diffopts->pathspec.count; ++i)
+		free(diffopts->pathspec.strings[i]);
+
+	free(diffopts->pathspec.strings);
+
+	diffopts->pathspec.strings = NULL;
+	diffopts->pathspec.count   = 0;
+}
+
+static int vec2strarray(git_strarray &arr, const vector<string> &vec)
+{
+	auto count = vec.size();
+	decltype(count) i = 0;
+
+	arr.strings = NULL;
+	arr.count   = 0;
+
+	if (count == 0)
+		return 0;
+
+	arr.strings = (char **)malloc(count * sizeof(char *));
+	if (!arr.strings)
+		return -1;
+
+	for (;i < count; ++i) {
+		arr.strings[i] = strdup(vec[i].c_str());
+		if (!arr.strings[i])
+			goto out_free;
+	}
+
+	arr.count = count;
+
+	return 0;
+
+out_free:
+
+	for (decltype(i) j = 0; j < i; ++j)
+		free(arr.strings[j]);
+
+	free(arr.strings);
+	arr.strings = 0;
+
+	return -1;
+}
+
+bool git_fixes::init_diffopts(struct fixes_run &run, git_diff_options *diffopts,
+			      vector<string> &path) const
+{
+	git_strarray arr;
+	bool ret = true;
+
+	if (vec2strarray(diffopts->pathspec, path))
+		return false;
+
+	if (vec2strarray(arr, opts.bl_path))
+		return false;
+
+	if (arr.count) {
+		auto err = git_pathspec_new(&run.bl_pathspec, &arr);
+		if (err) {
+			ret = false;
+			goto out_free;
+		}
+	}
+
+out_free:
+	git_strarray_free(&arr);
+
+	return ret;
+}
+
+void git_fixes::remove_reverts(struct fixes_run &run) const
+{
+	trace_span span("remove_reverts");
+	perf_phase phase("remove_reverts");
+	mem_phase mphase("remove_reverts");
+	std::map<std::string, bool> r;
+
+	for (auto &_r : run.reverts)
+		r[_r.second]  = true;
+
+	for (auto &entry : run.results) {
+		auto &commits = entry.second;
+		auto pos = commits.begin();
+
+		while (pos != commits.end()) {
+			auto p = r.find(pos->id);
+
+			if (p != r.end())
+				pos = commits.erase(pos);
+			else
+				pos += 1;
+		}
+	}
+}
+
+/* Every n-th commit of the walk gets a span in the trace */
+static const unsigned long trace_commit_sample = 64;
+
+int git_fixes::run(git_repository *repo, const string &rev)
+{
+	return run(repo, rev, last_run);
+}
+
+int git_fixes::run(git_repository *repo, const string &rev,
+		   struct fixes_run &run) const
+{
+	trace_span run_span("run");
+	git_diff_options diffopts = GIT_DIFF_OPTIONS_INIT;
+	int sorting = GIT_SORT_TIME;
+	struct commit_scratch scratch;
+	struct perf_values walk_start;
+	struct mem_values mem_start;
+	vector<string> path;
+	git_revwalk *walker;
+	git_commit *commit;
+	unsigned long allocs;
+	string revision;
+	git_oid oid;
+	int err;
+
+	run.results.clear();
+	run.reverts.clear();
+	run.stats = fixes_stats();
+	path  = opts.path;
+
+	revision = fix_revision(rev);
+
+	err = revwalk_init(&walker, repo, revision.c_str());
+	if (err < 0) {
+		/*
+		 * Parsing revision failed - fall back to HEAD and
+		 * interpret it as path
+		 */
+		err = revwalk_init(&walker, repo, "HEAD");
+		if (err < 0)
+			return err;
+		path.push_back(rev);
+	}
+
+	if (opts.reverse)
+		sorting |= GIT_SORT_REVERSE;
+
+	git_revwalk_sorting(walker, sorting);
+
+	err = -1;
+	if (!init_diffopts(run, &diffopts, path))
+		goto error;
+
+	scratch.refs.reserve(16);
+
+	allocs = opts.alloc_count ? opts.alloc_count() : 0;
+	run.stats.walk_allocs = allocs;
+
+	if (perf_enabled)
+		perf_read(walk_start);
+
+	if (mem_enabled)
+		mem_read(mem_start);
+
+	while (!git_revwalk_next(&oid, walker)) {
+		// Tracing every commit would be too much, only sample them
+		trace_span span(run.stats.count % trace_commit_sample ? NULL :
+				"handle_commit");
+
+		run.stats.count += 1;
+
+		err = git_commit_lookup(&commit, repo, &oid);
+		if (err < 0)
+			goto error;
+
+		if (opts.alloc_count)
+			allocs = opts.alloc_count();
+
+		err = handle_commit(run, commit, repo, &diffopts, scratch);
+		if (err < 0) {
+			git_commit_free(commit);
+			goto error;
+		}
+
+		if (!err && opts.alloc_count)
+			run.stats.nomatch_allocs += opts.alloc_count() - allocs;
+
+		git_commit_free(commit);
+		run.stats.match += err;
+	}
+
+	if (opts.alloc_count)
+		run.stats.walk_allocs = opts.alloc_count() - run.stats.walk_allocs;
+
+	if (perf_enabled)
+		perf_add_phase("walk", walk_start);
+
+	if (mem_enabled)
+		mem_add_phase("walk", mem_start);
+
+	// Remove reverted commits from the fixes list
+	remove_reverts(run);
+
+	err = 0;
+
+error:
+	destroy_diffopts(&diffopts);
+	if (run.bl_pathspec) {
+		git_pathspec_free(run.bl_pathspec);
+		run.bl_pathspec = NULL;
+	}
+	git_revwalk_free(walker);
+
+	return err;
+}
+
+const fixes_results &git_fixes::get_results(void) const
+{
+	return last_run.results;
+}
+
+const struct fixes_stats &git_fixes::get_stats(void) const
+{
+	return last_run.stats;
+}
+
+/*
+ * C interface
+ */
+
+struct gitfixes {
+	git_fixes engine;
+	vector<pair<const string *, const struct commit *> > flat;
+};
+
+struct gitfixes *gitfixes_new(void)
+{
+	return new (nothrow) gitfixes;
+}
+
+void gitfixes_free(struct gitfixes *fixes)
+{
+	delete fixes;
+}
+
+static bool parse_bool(const char *value, bool def)
+{
+	if (!value)
+		return def;
+
+	return !(strcmp(value, "0") == 0 || strcasecmp(value, "false") == 0 ||
+		 strcasecmp(value, "no") == 0);
+}
+
+int gitfixes_set_option(struct gitfixes *fixes, const char *name,
+			const char *value)
+{
+	struct fixes_options opts = fixes->engine.get_options();
+	string n(name);
+
+	if (n == "committer" && value) {
+		opts.committer = value;
+		opts.all       = false;
+	} else if (n == "all") {
+		opts.all = parse_bool(value, true);
+	} else if (n == "match-all") {
+		opts.match_all = parse_bool(value, true);
+	} else if (n == "grouping") {
+		opts.no_group = !parse_bool(value, true);
+	} else if (n == "no-grouping") {
+		opts.no_group = parse_bool(value, true);
+	} else if (n == "reverse") {
+		opts.reverse = parse_bool(value, true);
+	} else if (n == "stable") {
+		opts.stable    = true;
+		opts.no_stable = false;
+	} else if (n == "no-stable") {
+		opts.stable    = false;
+		opts.no_stable = true;
+	} else if (n == "no-blacklist") {
+		opts.no_blacklist = parse_bool(value, true);
+	} else if (n == "domains" && value) {
+		split_trim(opts.domains, ",", string(value), 0);
+	} else if (n == "path" && value) {
+		opts.path.emplace_back(value);
+	} else if (n == "path-blacklist" && value) {
+		opts.bl_path.emplace_back(value);
+	} else if (n == "trailer" && value) {
+		opts.trailers.emplace_back(value);
+	} else {
+		return -1;
+	}
+
+	return fixes->engine.set_options(opts) ? 0 : -1;
+}
+
+int gitfixes_load_commit_file(struct gitfixes *fixes, const char *filename)
+{
+	return fixes->engine.load_commit_file(filename) ? 0 : -1;
+}
+
+int gitfixes_load_ignore_file(struct gitfixes *fixes, const char *filename)
+{
+	return fixes->engine.load_ignore_file(filename) ? 0 : -1;
+}
+
+int gitfixes_load_blacklist_file(struct gitfixes *fixes, const char *filename)
+{
+	return fixes->engine.load_blacklist_file(filename) ? 0 : -1;
+}
+
+int gitfixes_load_path_blacklist_file(struct gitfixes *fixes,
+				      const char *filename)
+{
+	return fixes->engine.load_path_blacklist_file(filename) ? 0 : -1;
+}
+
+int gitfixes_load_path_map(struct gitfixes *fixes, const char *filename)
+{
+	return fixes->engine.load_path_map(filename) ? 0 : -1;
+}
+
+int gitfixes_load_owner_ignore_file(struct gitfixes *fixes,
+				    const char *filename)
+{
+	return fixes->engine.load_owner_ignore_file(filename) ? 0 : -1;
+}
+
+int gitfixes_load_stable_index(struct gitfixes *fixes, git_repository *repo,
+			       const char *range, const char *cache_file)
+{
+	return fixes->engine.load_stable_index(repo, range,
+					       cache_file ? cache_file : "") ? 0 : -1;
+}
+
+int gitfixes_run(struct gitfixes *fixes, git_repository *repo,
+		 const char *revision)
+{
+	int err;
+
+	fixes->flat.clear();
+
+	err = fixes->engine.run(repo, revision);
+	if (err < 0)
+		return err;
+
+	for (auto &r : fixes->engine.get_results()) {
+		for (auto &c : r.second)
+			fixes->flat.emplace_back(&r.first, &c);
+	}
+
+	return 0;
+}
+
+size_t gitfixes_result_count(const struct gitfixes *fixes)
+{
+	return fixes->flat.size();
+}
+
+int gitfixes_result_get(const struct gitfixes *fixes, size_t idx,
+			struct gitfixes_result *result)
+{
+	const struct commit *c;
+
+	if (idx >= fixes->flat.size())
+		return -1;
+
+	c = fixes->flat[idx].second;
+
+	result->group   = fixes->flat[idx].first->c_str();
+	result->id      = c->id.c_str();
+	result->subject = c->subject.c_str();
+	result->context = c->context.c_str();
+	result->path    = c->path.c_str();
+	result->stable  = c->stable;
+	result->by_subject = c->by_subject;
+
+	return 0;
+}
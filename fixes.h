@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2016-2018 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __FIXES_H
+#define __FIXES_H
+
+#include <stddef.h>
+
+#include <git2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * C interface to the git-fixes engine. Each engine instance carries its
+ * own commit-list, blacklists and options, so different instances can be
+ * used from different threads at the same time.
+ */
+struct gitfixes;
+
+struct gitfixes_result {
+	const char *group;
+	const char *id;
+	const char *subject;
+	const char *context;
+	const char *path;
+	int stable;
+	int by_subject;
+};
+
+struct gitfixes *gitfixes_new(void);
+void gitfixes_free(struct gitfixes *fixes);
+
+/*
+ * Options use the names of the git-fixes command line options, e.g.
+ * "committer", "all", "match-all", "no-grouping", "stable", "no-stable",
+ * "no-blacklist", "domains", "path", "path-blacklist" or "trailer". Boolean
+ * options take NULL as value.
+ */
+int gitfixes_set_option(struct gitfixes *fixes, const char *name,
+			const char *value);
+
+/*
+ * The loaders return -1 when the file can't be opened. An empty filename
+ * loads nothing and succeeds, except for the commit-list.
+ */
+int gitfixes_load_commit_file(struct gitfixes *fixes, const char *filename);
+int gitfixes_load_ignore_file(struct gitfixes *fixes, const char *filename);
+int gitfixes_load_blacklist_file(struct gitfixes *fixes, const char *filename);
+int gitfixes_load_path_blacklist_file(struct gitfixes *fixes,
+				      const char *filename);
+
+/*
+ * With a path-map loaded, fixes for Base and Unknown commits are assigned
+ * to the developer the path-map names for the files the fix changes.
+ */
+int gitfixes_load_path_map(struct gitfixes *fixes, const char *filename);
+int gitfixes_load_owner_ignore_file(struct gitfixes *fixes,
+				    const char *filename);
+
+/*
+ * Fixes which a stable tree in the given range already carries as
+ * "commit <id> upstream." are treated like fixes already in the tree.
+ * The index is kept in cache_file, when not NULL, and later calls only
+ * scan the stable commits added since.
+ */
+int gitfixes_load_stable_index(struct gitfixes *fixes, git_repository *repo,
+			       const char *range, const char *cache_file);
+
+int gitfixes_run(struct gitfixes *fixes, git_repository *repo,
+		 const char *revision);
+
+size_t gitfixes_result_count(const struct gitfixes *fixes);
+int gitfixes_result_get(const struct gitfixes *fixes, size_t idx,
+			struct gitfixes_result *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FIXES_H */
@@ -16,7 +16,11 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <new>
+#include <thread>
 
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -24,94 +28,66 @@
 #include <stdio.h>
 #include <git2.h>
 
+#include "engine.h"
+#include "perf.h"
+#include "mem.h"
+#include "trace.h"
+#include "trailer.h"
+#include "tune.h"
+#include "suse.h"
+
 #if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR < 22
 #error "libgit2 version 0.22.0 or newer is required. Try 'make BUILD_LIBGIT2=1'"
 #endif
 
 using namespace std;
 
+/* A --repo option, the revision defaults to the one given after the options */
+struct repo_spec {
+	string path;
+	string revision;
+};
+
 struct options {
-	string repo_path;
+	vector<struct repo_spec> repos;
 	string revision;
-	string committer;
 	string fixes_file;
 	string ignore_file;
 	string bl_file;
 	string bl_path_file;
 	string db;
+	string suse_repo;
+	string suse_rev;
+	vector<string> stable_ranges;
+	string stable_cache;
+	bool stable_cache_enabled;
+	string path_map;
+	string trace_file;
+	bool owners;
+	bool perf_counters;
+	bool mem_stats;
 	bool all_cmdline;
-	bool all;
-	bool match_all;
-	bool no_group;
 	bool stats;
-	bool reverse;
-	bool stable;
-	bool no_stable;
 	bool write_bl;
-	bool no_blacklist;
 	bool parsable;
 	bool patch;
-	vector<string> path;
-	vector<string> bl_path;
-	vector<string> domains;
-};
-
-struct commit {
-	string subject;
-	string context;
-	string id;
-	string path;
-	bool stable;
+	vector<string> bl_add;
+	struct git_tuning tuning;
 
-	vector<struct reference> refs;
-
-	commit() : stable(false) { };
-};
-
-struct reference {
-	string id;
-	bool fixes;
-
-	reference()
-		: id(), fixes(false)
-	{ }
+	struct fixes_options engine;
 };
 
-struct match_info {
-	string commit_id;
-	string committer;
-	string path;
-
-	bool operator<(const struct match_info &i) const
-	{
-		return commit_id < i.commit_id;
-	}
-};
-
-vector<struct match_info> match_list;
-map<string, vector<commit> > results;
-map<string, string> reverts;
-vector<string> blacklist;
-git_pathspec *bl_pathspec;
-
-static bool is_hex(const string &s)
-{
-	for (string::const_iterator c = s.begin(); c != s.end(); ++c) {
-		if (!isxdigit(*c))
-			return false;
-	}
-
-	return true;
-}
-
-static string to_lower(string s)
+/*
+ * Number of C++ heap allocations of the calling thread, reported with
+ * --stats. Walks of several repos run in parallel and must not count
+ * each other's allocations.
+ */
+static unsigned long alloc_count(void)
 {
-	transform(s.begin(), s.end(), s.begin(), ::tolower);
-
-	return s;
+	return mem_thread_allocs;
 }
 
-string trim(const string &line)
+static string trim(const string &line)
 {
 	static const char *spaces = " \n\t\r";
 	size_t pos1, pos2;
@@ -156,346 +132,17 @@ static int split_trim(vector<string> &items, const char *delim,
 	return num;
 }
 
-string fix_revision(string rev)
-{
-	if (rev.length() < 2)
-		return rev;
-
-	if (rev.substr(0,2) == "..")
-		rev = "HEAD" + rev;
-
-	if (rev.substr(rev.length() - 2, 2) == "..")
-		rev = rev + "HEAD";
-
-	return rev;
-}
-
-static bool is_blacklisted(const string &commit_id)
-{
-	vector<string>::const_iterator it;
-
-	it = lower_bound(blacklist.begin(), blacklist.end(), commit_id);
-
-	return (it != blacklist.end() && *it == commit_id);
-}
-
-static int diff_file_cb(const git_diff_delta *delta, float progess, void *data)
-{
-	bool *match = (bool *)data;
-	git_pathspec_flag_t flags = GIT_PATHSPEC_USE_CASE;
-
-	if (!git_pathspec_matches_path(bl_pathspec, flags, delta->old_file.path))
-		*match = false;
-
-	if (!git_pathspec_matches_path(bl_pathspec, flags, delta->new_file.path))
-		*match = false;
-
-	return 0;
-}
-
-static int match_parent_tree(git_commit *commit, size_t p,
-			     git_diff_options *diffopts)
-{
-	bool b_listed = false;
-	git_commit *parent;
-	git_tree *a, *b;
-	git_diff *diff;
-	int err;
-
-	err = git_commit_parent(&parent, commit, p);
-	if (err)
-		return err;
-
-	err = git_commit_tree(&a, parent);
-	if (err)
-		goto out_free_parent;
-
-	err = git_commit_tree(&b, commit);
-	if (err)
-		goto out_free_a;
-
-	err = git_diff_tree_to_tree(&diff, git_commit_owner(commit), a, b, diffopts);
-	if (err < 0)
-		goto out_free_b;
-
-	if (bl_pathspec) {
-		b_listed = true;
-#if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR < 23
-		git_diff_foreach(diff, diff_file_cb, NULL, NULL, &b_listed);
-#else
-		git_diff_foreach(diff, diff_file_cb, NULL, NULL, NULL, &b_listed);
-#endif
-	}
-
-	err = git_diff_num_deltas(diff) > 0 ? 1 : 0;
-
-	if (b_listed)
-		err = 0;
-
-	git_diff_free(diff);
-out_free_b:
-	git_tree_free(b);
-out_free_a:
-	git_tree_free(a);
-out_free_parent:
-	git_commit_free(parent);
-
-	return err;
-}
-
-static bool match_tree(git_commit *commit, git_diff_options *diffopts)
-{
-	git_pathspec *ps = NULL;
-	unsigned int parents;
-	bool ret = false;
-	int err;
-
-	if (diffopts->pathspec.count <= 0 && bl_pathspec == NULL)
-		return true;
-
-	parents = git_commit_parentcount(commit);
-
-	if (parents == 0) {
-		git_tree *tree;
-
-		err = git_pathspec_new(&ps, &diffopts->pathspec);
-		if (err < 0)
-			return false;
-		err = git_commit_tree(&tree, commit);
-		if (err < 0)
-			return false;
-
-		err = git_pathspec_match_tree(NULL, tree, GIT_PATHSPEC_NO_MATCH_ERROR, ps);
-		if (!err)
-			ret = true;
-
-		git_tree_free(tree);
-		git_pathspec_free(ps);
-	} else {
-		for (unsigned i = 0; i < parents; ++i) {
-			if (match_parent_tree(commit, i, diffopts) > 0) {
-				ret = true;
-				break;
-			}
-		}
-	}
-
-	return ret;
-}
-
-static bool match_domain(const vector<string> &domains, const string &email)
+static void print_results(const fixes_results &results, struct options *opts)
 {
-	auto pos = email.find_first_of("@");
-
-	if (pos == string::npos)
-		return false;
-
-	string domain = to_lower(trim(email.substr(pos + 1)));
-
-	for (auto &d : domains) {
-		if (d == domain)
-			return true;
-	}
-
-	return false;
-}
-
-static bool match_commit(const struct commit &c, const string &id,
-			 git_commit *commit, git_diff_options *diffopts,
-			 struct options *opts)
-{
-	vector<struct match_info>::const_iterator it;
-	string author, committer, context;
-	const git_signature *sig;
-	struct match_info info;
-	bool ret;
-
-	if ((!opts->stable    &&  c.stable) ||
-	    (!opts->no_stable && !c.stable))
-		return false;
-
-	/* First check if the commit is already in the tree */
-	info.commit_id = to_lower(c.id);
-	it = lower_bound(match_list.begin(), match_list.end(), info);
-	if (it != match_list.end() && it->commit_id == info.commit_id)
-		return false;
-
-	info.commit_id = to_lower(id);
-
-	it = lower_bound(match_list.begin(), match_list.end(), info);
-
-	if (it == match_list.end() || it->commit_id != info.commit_id)
-		return false;
-
-	context = it->committer;
-
-	// Load author and committer of potential fix
-	sig = git_commit_author(commit);
-	if (sig)
-		author = to_lower(sig->email);
-
-	sig = git_commit_committer(commit);
-	if (sig)
-		committer = to_lower(sig->email);
-
-	if (match_domain(opts->domains, author))
-		context = author;
-	else if (match_domain(opts->domains, committer))
-		context = committer;
-
-	if (!opts->all && opts->committer.length() > 0) {
-		if (context.find(opts->committer) == string::npos)
-			return false;
-	}
-
-	ret = (it->commit_id == info.commit_id) &&
-	       match_tree(commit, diffopts);
-
-	if (ret) {
-		struct commit __commit = c;
-		string key = opts->no_group ? "default" : context;
-
-		__commit.context = context;
-		__commit.path    = it->path;
-		results[key].emplace_back(__commit);
-	}
-
-	return ret;
-}
-
-static bool isdelim(int c)
-{
-	return isblank(c) || c == ':';
-}
-
-static void parse_line(const string &line, struct commit &cm)
-{
-	bool found_commit = false;
-	string::const_iterator c;
-	struct reference commit;
-	int last_c = -1;
-
-	if (line.length() >= 6 && to_lower(line.substr(0,6)) == "fixes:")
-		commit.fixes = true;
-
-	if (line.length() == 61 &&
-	    line.substr(0,19) == "This reverts commit") {
-		string id = line.substr(20, 40);
-
-		if (is_hex(id)) {
-			reverts[cm.id] = id;
-			commit.id = id;
-			commit.fixes = true;
-			cm.refs.push_back(commit);
-			return;
-		}
-	}
-
-	for (c = line.begin(); c != line.end(); last_c = *c, ++c) {
-		bool hex = isxdigit(*c);
-
-		if (isdelim(last_c) && hex) {
-			found_commit = true;
-		}
-
-		if (found_commit && hex)
-			commit.id += *c;
-
-		if (found_commit && (isdelim(*c) || (c + 1) == line.end())) {
-			int len = commit.id.length();
-
-			if (len >= 8 && len <= 40)
-				cm.refs.push_back(commit);
-		}
-
-		if (found_commit && !hex) {
-			found_commit = false;
-			commit.id.clear();
-		}
-	}
-}
-
-static void parse_commit_msg(struct commit &commit, const char *msg)
-{
-	vector<string>::iterator it;
-	vector<string> lines;
-	string buffer(msg);
-
-	split_trim(lines, "\n", buffer, 0);
-
-	if (!lines.size())
-		return;
-
-	commit.subject = lines[0];
-
-	for (it = lines.begin(); it != lines.end(); ++it) {
-		if (it->find("stable@kernel.org")      != string::npos ||
-		    it->find("stable@vger.kernel.org") != string::npos)
-			commit.stable = true;
-		parse_line(*it, commit);
-	}
-}
-
-static int handle_commit(git_commit *commit, git_repository *repo,
-			 git_diff_options *diffopts, struct options *opts)
-{
-	const git_oid *oid;
-	char commit_id[41];
-	struct commit c;
-	const char *msg;
-	int error;
-
-	oid = git_commit_id(commit);
-
-	git_oid_fmt(commit_id, oid);
-	commit_id[40] = 0;
-
-	if (!opts->no_blacklist && is_blacklisted(commit_id))
-		return 0;
-
-	/* Ignore merge and root commits */
-	if (git_commit_parentcount(commit) != 1)
-		return 0;
-
-	msg = git_commit_message(commit);
-	c.id = commit_id;
-	parse_commit_msg(c, msg);
-
-	error = 0;
-	if (c.refs.size() > 0) {
-		vector<struct reference>::iterator it;
-
-		for (it = c.refs.begin(); it != c.refs.end(); ++it) {
-			git_object *obj;
-
-			if (git_revparse_single(&obj, repo, it->id.c_str()) < 0)
-				continue;
-
-			string id(git_oid_tostr_s(git_object_id(obj)));
-
-			git_object_free(obj);
-
-			if (!opts->match_all && !it->fixes)
-				continue;
-
-			if (match_commit(c, id, commit, diffopts, opts)) {
-				error = 1;
-				break;
-			}
-		}
-	}
-
-	return error;
-}
-
-static void print_results(struct options *opts)
-{
-	map<string, vector<commit> >::iterator r;
-	vector<commit>::iterator i;
+	trace_span span("print_results");
+	perf_phase phase("print_results");
+	mem_phase mphase("print_results");
+	fixes_results::const_iterator r;
+	vector<commit>::const_iterator i;
 	const char *prefix;
 	bool found = false;
 
-	prefix = opts->no_group ? "" : "\t";
+	prefix = opts->engine.no_group ? "" : "\t";
 
 	for (r = results.begin(); r != results.end(); ++r) {
 		if (!r->second.size())
@@ -505,11 +152,12 @@ static void print_results(struct options *opts)
 
 		if (opts->parsable) {
 			for (i = r->second.begin(); i != r->second.end(); ++i) {
-				printf("%s;%s;%s;%s\n", i->context.c_str(),
+				printf("%s%s;%s;%s;%s\n", i->context.c_str(),
+					i->by_subject ? " (matched by subject)" : "",
 					i->id.c_str(), i->path.c_str(), i->subject.c_str());
 			}
 		} else {
-			if (!opts->no_group)
+			if (!opts->engine.no_group)
 				printf("%s (%lu):\n", r->first.c_str(), r->second.size());
 
 			for (i = r->second.begin(); i != r->second.end(); ++i) {
@@ -518,8 +166,10 @@ static void print_results(struct options *opts)
 						i->subject.c_str());
 				if (opts->patch && i->path != "")
 					printf("%s  (Fixes %s)\n", prefix, i->path.c_str());
+				if (opts->engine.no_group && i->by_subject)
+					printf("%s  (matched by subject)\n", prefix);
 			}
-			if (!opts->no_group)
+			if (!opts->engine.no_group)
 				printf("\n");
 		}
 	}
@@ -528,399 +178,238 @@ static void print_results(struct options *opts)
 		printf("Nothing found\n");
 }
 
-static void load_commits(istream &in, vector<struct match_info> &commits)
-{
-	string line;
-
-	while (getline(in, line)) {
-		struct match_info info;
-		vector<string> tokens;
-		int num;
-
-		num = split_trim(tokens, ",", line, 3);
-
-		if (!num)
-			continue;
-
-		info.commit_id = to_lower(tokens[0]);
-		if (num > 1)
-			info.committer = tokens[1];
-		if (num > 2)
-			info.path      = tokens[2];
-
-		commits.emplace_back(info);
-	}
-
-	sort(commits.begin(), commits.end());
-}
+/* A repository scanned by its own thread */
+struct repo_scan {
+	const struct repo_spec *spec;
+	git_repository *repo;
+	struct fixes_run run;
+	map<string, string> patch_ids;	// Of the fixes found, by commit-id
+	string error;
+	int err;
+};
 
-static void load_ignore_file(string filename)
+/* Patch-id of a fix, the same change has the same one in every tree */
+static int patch_id(string &out, git_repository *repo, const string &id)
 {
-	vector<struct match_info> commits;
-	ifstream file;
-
-	if (filename == "")
-		return;
+	git_commit *commit = NULL, *parent = NULL;
+	git_tree *a = NULL, *b = NULL;
+	git_diff *diff = NULL;
+	char buf[41];
+	git_oid oid;
+	int err;
 
-	file.open(filename.c_str());
-	if (!file.is_open()) {
-		printf("Can't open ignore-file: %s\n", filename.c_str());
-		return;
-	}
+	err = git_oid_fromstr(&oid, id.c_str());
+	if (err)
+		return err;
 
-	load_commits(file, commits);
+	err = git_commit_lookup(&commit, repo, &oid);
+	if (err)
+		goto out;
 
-	for (auto &c : commits)
-		blacklist.push_back(c.commit_id);
+	err = git_commit_parent(&parent, commit, 0);
+	if (err)
+		goto out;
 
-	sort(blacklist.begin(), blacklist.end());
+	err = git_commit_tree(&a, parent);
+	if (err)
+		goto out;
 
-	return;
-}
+	err = git_commit_tree(&b, commit);
+	if (err)
+		goto out;
 
-static bool load_commit_file(const char *filename, vector<struct match_info> &commits)
-{
-	ifstream file;
-	istream *in;
+	err = git_diff_tree_to_tree(&diff, repo, a, b, NULL);
+	if (err)
+		goto out;
 
-	if (strcmp(filename, "") == 0) {
-		printf("No file given to load commit-list from.\n");
-		printf("Either use the -f option or set the fixes.file config variable in git.\n");
-		return false;
-	} else if (strcmp(filename, "-") == 0) {
-		in = &cin;
-	} else {
-		file.open(filename);
-		if (!file.is_open()) {
-			printf("Can't open file '%s'\n", filename);
-			return false;
-		}
+	// All empty commits would have the same patch-id
+	err = -1;
+	if (!git_diff_num_deltas(diff))
+		goto out;
 
-		in = &file;
-	}
+	err = git_diff_patchid(&oid, diff, NULL);
+	if (err)
+		goto out;
 
-	load_commits(*in, commits);
+	out = git_oid_tostr(buf, sizeof(buf), &oid);
 
-	if (file.is_open())
-		file.close();
+out:
+	git_diff_free(diff);
+	git_tree_free(b);
+	git_tree_free(a);
+	git_commit_free(parent);
+	git_commit_free(commit);
 
-	return true;
+	return err;
 }
 
-static void load_blacklist_file(const string &filename)
+static void scan_repo(const git_fixes &engine, struct repo_scan &scan,
+		      struct options *opts, bool need_patch_ids)
 {
-	ifstream file;
-	string line;
-
-	if (filename == "")
-		return;
-
-	file.open(filename.c_str());
-
-	if (!file.is_open())
-		return;
+	const string &rev = scan.spec->revision != "" ? scan.spec->revision
+						       : opts->revision;
 
-	while (getline(file, line)) {
-		line = to_lower(trim(line));
-		if (!is_hex(line))
-			continue;
+	if (opts->tuning.prefetch > 0) {
+		perf_phase phase("prefetch");
 
-		blacklist.push_back(line);
+		tune_prefetch(scan.repo);
 	}
 
-	file.close();
-
-	sort(blacklist.begin(), blacklist.end());
-}
+	scan.err = engine.run(scan.repo, rev, scan.run);
+	if (scan.err < 0) {
+		const git_error *e = giterr_last();
 
-static void load_bl_path_file(const string &filename, struct options *opts)
-{
-	ifstream file;
-
-	if (filename == "")
-		return;
-
-	file.open(filename.c_str());
-
-	if (!file.is_open())
+		scan.error = e ? e->message : "Can't scan " + scan.spec->path;
 		return;
-
-	while (!file.eof()) {
-		string line;
-
-		getline(file, line);
-
-		auto pos = line.find_first_of("#");
-		if (pos != string::npos)
-			line = line.substr(0, pos);
-
-		line = trim(line);
-
-		if (line != "")
-			opts->bl_path.emplace_back(line);
 	}
 
-	file.close();
-}
-
-static bool write_blacklist_file(const string &filename)
-{
-	ofstream file;
-
-	file.open(filename.c_str());
-
-	if (!file.is_open())
-		return false;
-
-	for (vector<string>::iterator it = blacklist.begin();
-	     it != blacklist.end();
-	     ++it)
-		file << *it << endl;
-
-	file.close();
-
-	return true;
-}
-
-static void sanitize_blacklist(git_repository *repo)
-{
-	vector<string> old_blacklist = blacklist;
+	if (!need_patch_ids)
+		return;
 
-	blacklist.clear();
+	for (auto &r : scan.run.results) {
+		for (auto &c : r.second) {
+			string id;
 
-	for (vector<string>::iterator it = old_blacklist.begin();
-	     it != old_blacklist.end();
-	     ++it) {
-		git_object *obj;
-		int error;
-
-		error = git_revparse_single(&obj, repo, it->c_str());
-		if (error) {
-			fprintf(stderr, "Blacklisted commit %s can't be found - removing\n",
-				it->c_str());
-			continue;
+			// Without a patch-id the fix is still found by its commit-id
+			if (!patch_id(id, scan.repo, c.id))
+				scan.patch_ids[c.id] = id;
 		}
-
-		blacklist.push_back(git_oid_tostr_s(git_object_id(obj)));
-
-		git_object_free(obj);
 	}
 }
 
-static int revwalk_init(git_revwalk **walker, git_repository *repo,
-			const char *revision)
+/*
+ * Collects the results of all scans in the order of the --repo options.
+ * A fix found in an earlier repository is dropped from later ones, by
+ * its commit-id or, when it was applied separately, by its patch-id.
+ */
+static unsigned long merge_scans(fixes_results &results,
+				 struct fixes_stats &stats,
+				 const vector<struct repo_scan> &scans)
 {
-	git_revspec spec;
-	int err;
-
-	err = git_revwalk_new(walker, repo);
-	if (err)
-		return err;
-
-	err = git_revparse(&spec, repo, revision);
-	if (err)
-		goto out_free;
-
-	if (spec.flags & GIT_REVPARSE_SINGLE) {
-		git_revwalk_push(*walker, git_object_id(spec.from));
-		git_object_free(spec.from);
-	} else if (spec.flags & GIT_REVPARSE_RANGE) {
-		git_revwalk_push(*walker, git_object_id(spec.to));
-
-		if (spec.flags & GIT_REVPARSE_MERGE_BASE) {
-			git_oid base;
-			err = git_merge_base(&base, repo,
-					     git_object_id(spec.from),
-					     git_object_id(spec.to));
-			if (err) {
-				git_object_free(spec.to);
-				git_object_free(spec.from);
-				goto out_free;
+	set<string> ids, patch_ids;
+	unsigned long dups = 0;
+
+	for (auto &scan : scans) {
+		const struct fixes_stats &s = scan.run.stats;
+		vector<pair<string, string> > found;
+
+		stats.count          += s.count;
+		stats.match          += s.match;
+		stats.walk_allocs    += s.walk_allocs;
+		stats.nomatch_allocs += s.nomatch_allocs;
+		stats.stable         += s.stable;
+
+		for (auto &r : scan.run.results) {
+			for (auto &c : r.second) {
+				auto p = scan.patch_ids.find(c.id);
+				string pid = p != scan.patch_ids.end() ? p->second : "";
+
+				if (ids.find(c.id) != ids.end() ||
+				    (pid != "" && patch_ids.find(pid) != patch_ids.end())) {
+					dups += 1;
+					continue;
+				}
+
+				results[r.first].push_back(c);
+				found.emplace_back(c.id, pid);
 			}
-
-			git_revwalk_push(*walker, &base);
 		}
 
-		git_revwalk_hide(*walker, git_object_id(spec.from));
-		git_object_free(spec.to);
-		git_object_free(spec.from);
-	}
-
-	return 0;
-
-out_free:
-	git_revwalk_free(*walker);
-
-	return err;
-}
-
-static void destroy_diffopts(git_diff_options *diffopts)
-{
-	if (!diffopts->pathspec.strings)
-		return;
-
-	for (unsigned i = 0; i < diffopts->pathspec.count; ++i)
-		free(diffopts->pathspec.strings[i]);
-
-	free(diffopts->pathspec.strings);
-
-	diffopts->pathspec.count = 0;
-}
-
-int vec2strarray(git_strarray &arr, vector<string> &vec)
-{
-	auto count = vec.size();
-	decltype(count) i = 0;
-
-	arr.strings = NULL;
-	arr.count   = 0;
-
-	if (count == 0)
-		return 0;
-
-	arr.strings = (char **)malloc(count * sizeof(char *));
-	if (!arr.strings)
-		return -1;
-
-	for (;i < count; ++i) {
-		arr.strings[i] = strdup(vec[i].c_str());
-		if (!arr.strings[i])
-			goto out_free;
-	}
-
-	arr.count = count;
-
-	return 0;
-
-out_free:
-
-	for (decltype(i) j = 0; j < i; ++j)
-		free(arr.strings[j]);
-
-	free(arr.strings);
-	arr.strings = 0;
-
-	return -1;
-}
-
-static bool init_diffopts(git_diff_options *diffopts, struct options *opts)
-{
-	git_strarray arr;
-	bool ret = true;
-
-	if (vec2strarray(diffopts->pathspec, opts->path))
-		return false;
-
-	if (vec2strarray(arr, opts->bl_path))
-		return false;
-
-	if (arr.count) {
-		auto err = git_pathspec_new(&bl_pathspec, &arr);
-		if (err) {
-			ret = false;
-			goto out_free;
+		// Only fixes in other trees are duplicates
+		for (auto &f : found) {
+			ids.insert(f.first);
+			if (f.second != "")
+				patch_ids.insert(f.second);
 		}
 	}
 
-out_free:
-	git_strarray_free(&arr);
-
-	return ret;
+	return dups;
 }
 
-static void remove_reverts(std::map<std::string, std::string> &reverts)
+static int fixes(git_fixes &engine, vector<git_repository *> &repos,
+		 struct options *opts)
 {
-	std::map<std::string, bool> r;
-
-	for (auto &_r : reverts)
-		r[_r.second]  = true;
-
-	for (auto &entry : results) {
-		auto &commits = entry.second;
-		auto pos = commits.begin();
-
-		while (pos != commits.end()) {
-			auto p = r.find(pos->id);
-
-			if (p != r.end())
-				pos = commits.erase(pos);
-			else
-				pos += 1;
-		}
+	vector<struct repo_scan> scans(repos.size());
+	struct fixes_stats stats = fixes_stats();
+	bool perf = perf_enabled, mem = mem_enabled;
+	struct perf_values walk_start;
+	struct mem_values mem_start;
+	vector<thread> workers;
+	fixes_results results;
+	unsigned long dups;
+
+	for (size_t i = 0; i < repos.size(); ++i) {
+		scans[i].spec = &opts->repos[i];
+		scans[i].repo = repos[i];
+		scans[i].err  = 0;
 	}
-}
-
-static int fixes(git_repository *repo, struct options *opts)
-{
-	git_diff_options diffopts = GIT_DIFF_OPTIONS_INIT;
-	int sorting = GIT_SORT_TIME;
-	int match = 0, count = 0;
-	git_revwalk *walker;
-	git_commit *commit;
-	string revision;
-	git_oid oid;
-	int err;
 
-	revision = fix_revision(opts->revision);
-
-	err = revwalk_init(&walker, repo, revision.c_str());
-	if (err < 0) {
-		/*
-		 * Parsing revision failed - fall back to HEAD and
-		 * interpret it as path
-		 */
-		err = revwalk_init(&walker, repo, "HEAD");
-		if (err < 0)
-			return err;
-		opts->path.push_back(opts->revision);
+	auto worker = [&](size_t i) {
+		if (trace_enabled && i)
+			trace_thread_name("repo " + scans[i].spec->path);
+
+		scan_repo(engine, scans[i], opts, scans.size() > 1);
+	};
+
+	/*
+	 * Counters are process-wide, phases of parallel scans would count
+	 * each other's work. Several repos are counted as one walk instead.
+	 */
+	if (scans.size() > 1) {
+		if (perf)
+			perf_read(walk_start);
+		if (mem)
+			mem_read(mem_start);
+
+		perf_enabled = false;
+		mem_enabled  = false;
 	}
 
-	if (opts->reverse)
-		sorting |= GIT_SORT_REVERSE;
+	for (size_t i = 1; i < scans.size(); ++i)
+		workers.emplace_back(worker, i);
 
-	git_revwalk_sorting(walker, sorting);
+	worker(0);
 
-	err = -1;
-	if (!init_diffopts(&diffopts, opts))
-		goto error;
+	for (auto &t : workers)
+		t.join();
 
-	while (!git_revwalk_next(&oid, walker)) {
-		count += 1;
+	if (scans.size() > 1) {
+		perf_enabled = perf;
+		mem_enabled  = mem;
 
-		err = git_commit_lookup(&commit, repo, &oid);
-		if (err < 0)
-			goto error;
+		if (perf)
+			perf_add_phase("walk", walk_start);
+		if (mem)
+			mem_add_phase("walk", mem_start);
+	}
 
-		err = handle_commit(commit, repo, &diffopts, opts);
-		if (err < 0) {
-			git_commit_free(commit);
-			goto error;
+	for (auto &scan : scans) {
+		if (scan.err < 0) {
+			printf("Error: %s\n", scan.error.c_str());
+			return scan.err;
 		}
-
-		git_commit_free(commit);
-		match += err;
 	}
 
-	// Remove reverted commits from the fixes list
-	remove_reverts(reverts);
+	dups = merge_scans(results, stats, scans);
 
-	destroy_diffopts(&diffopts);
-	if (bl_pathspec)
-		git_pathspec_free(bl_pathspec);
-	git_revwalk_free(walker);
+	print_results(results, opts);
 
-	print_results(opts);
+	if (opts->stats) {
+		printf("Found %lu objects (%lu matches)\n", stats.count, stats.match);
+		printf("Allocations: %lu during walk, %lu in non-matching commits\n",
+		       stats.walk_allocs, stats.nomatch_allocs);
+		if (stats.stable)
+			printf("Skipped %lu fixes already backported to stable\n",
+			       stats.stable);
+		if (dups)
+			printf("Dropped %lu fixes found in more than one repository\n",
+			       dups);
+	}
 
-	if (opts->stats)
-		printf("Found %d objects (%d matches)\n", count, match);
+	perf_report(stdout, "walk", stats.count);
+	mem_report(stdout);
 
 	return 0;
-
-error:
-	destroy_diffopts(&diffopts);
-	git_revwalk_free(walker);
-
-	return err;
 }
 
 #if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR < 23
@@ -972,19 +461,33 @@ static string config_get_path_nofail(git_config *cfg, const char *name)
 
 static void set_defaults(struct options *opts)
 {
-	opts->repo_path    = ".";
 	opts->revision     = "HEAD";
-	opts->reverse      = true;
-	opts->match_all    = false;
-	opts->all          = true;
-	opts->no_group     = false;
+	opts->suse_rev     = "HEAD";
+	opts->stable_cache_enabled = true;
+	opts->all_cmdline  = false;
 	opts->stats	   = false;
-	opts->stable       = true;
-	opts->no_stable    = true;
 	opts->write_bl     = false;
-	opts->no_blacklist = false;
 	opts->parsable     = false;
 	opts->patch        = false;
+	opts->owners       = false;
+	opts->perf_counters = false;
+	opts->mem_stats     = false;
+}
+
+static int config_trailer_cb(const git_config_entry *entry, void *data)
+{
+	struct options *opts = (struct options *)data;
+	struct trailer t;
+
+	if (trailer_parse(entry->value, t)) {
+		fprintf(stderr, "Ignoring invalid trailer in %s: %s\n",
+			entry->name, entry->value);
+		return 0;
+	}
+
+	opts->engine.trailers.emplace_back(entry->value);
+
+	return 0;
 }
 
 static int load_defaults_from_git(git_repository *repo, struct options *opts)
@@ -996,8 +499,8 @@ static int load_defaults_from_git(git_repository *repo, struct options *opts)
 	if (error < 0)
 		goto out;
 
-	if (opts->committer == "")
-		opts->committer = config_get_string_nofail(repo_cfg, "user.email");
+	if (opts->engine.committer == "")
+		opts->engine.committer = config_get_string_nofail(repo_cfg, "user.email");
 
 	if (opts->fixes_file == "")
 		opts->fixes_file = config_get_path_nofail(repo_cfg, "fixes.file");
@@ -1008,9 +511,12 @@ static int load_defaults_from_git(git_repository *repo, struct options *opts)
 	if (!opts->all_cmdline) {
 		error = git_config_get_bool(&val, repo_cfg, "fixes.all");
 		if (!error)
-			opts->all = val ? true : false;
+			opts->engine.all = val ? true : false;
 	}
 
+	git_config_get_multivar_foreach(repo_cfg, "fixes.trailer", NULL,
+					config_trailer_cb, opts);
+
 	error = 0;
 out:
 	git_config_free(repo_cfg);
@@ -1041,6 +547,23 @@ enum {
 	OPTION_PATH_BLACKLIST,
 	OPTION_PATCH,
 	OPTION_DOMAINS,
+	OPTION_SUSE_REPO,
+	OPTION_SUSE_REV,
+	OPTION_OWNERS,
+	OPTION_PATH_MAP,
+	OPTION_TRACE,
+	OPTION_PERF_COUNTERS,
+	OPTION_MEM_STATS,
+	OPTION_CACHE_SIZE,
+	OPTION_CACHE_LIMIT,
+	OPTION_MWINDOW_SIZE,
+	OPTION_MWINDOW_MAPPED_LIMIT,
+	OPTION_PREFETCH,
+	OPTION_NO_PREFETCH,
+	OPTION_TRAILER,
+	OPTION_STABLE_RANGE,
+	OPTION_STABLE_CACHE,
+	OPTION_NO_STABLE_CACHE,
 };
 
 static struct option options[] = {
@@ -1066,6 +589,23 @@ static struct option options[] = {
 	{ "path-blacklist",	required_argument,	0, OPTION_PATH_BLACKLIST },
 	{ "patch",		no_argument,		0, OPTION_PATCH          },
 	{ "domains",		required_argument,	0, OPTION_DOMAINS        },
+	{ "suse-repo",		required_argument,	0, OPTION_SUSE_REPO      },
+	{ "suse-rev",		required_argument,	0, OPTION_SUSE_REV       },
+	{ "owners",		no_argument,		0, OPTION_OWNERS         },
+	{ "path-map",		required_argument,	0, OPTION_PATH_MAP       },
+	{ "trace",		required_argument,	0, OPTION_TRACE          },
+	{ "perf-counters",	no_argument,		0, OPTION_PERF_COUNTERS  },
+	{ "mem-stats",		no_argument,		0, OPTION_MEM_STATS      },
+	{ "cache-size",		required_argument,	0, OPTION_CACHE_SIZE     },
+	{ "cache-limit",	required_argument,	0, OPTION_CACHE_LIMIT    },
+	{ "mwindow-size",	required_argument,	0, OPTION_MWINDOW_SIZE   },
+	{ "mwindow-mapped-limit", required_argument,	0, OPTION_MWINDOW_MAPPED_LIMIT },
+	{ "prefetch",		no_argument,		0, OPTION_PREFETCH       },
+	{ "no-prefetch",	no_argument,		0, OPTION_NO_PREFETCH    },
+	{ "trailer",		required_argument,	0, OPTION_TRAILER        },
+	{ "stable-range",	required_argument,	0, OPTION_STABLE_RANGE   },
+	{ "stable-cache",	required_argument,	0, OPTION_STABLE_CACHE   },
+	{ "no-stable-cache",	no_argument,		0, OPTION_NO_STABLE_CACHE },
 	{ 0,			0,			0, 0                     }
 };
 
@@ -1074,7 +614,12 @@ static void usage(const char *prg)
 	printf("Usage: %s [Options] [Revspec [Path...]]\n", prg);
 	printf("Options:\n");
 	printf("  --help, -h       Print this message end exit\n");
-	printf("  --repo, -r       Path to git repo (defaults to '.')\n");
+	printf("  --repo, -r       Path to git repo (defaults to '.'), optionally followed\n");
+	printf("                   by :<revspec>. Split at the last ':', when the revspec\n");
+	printf("                   has no '/' and the whole argument is no existing path.\n");
+	printf("                   Given more than once, the repos are scanned in\n");
+	printf("                   parallel and fixes found in several of them are\n");
+	printf("                   listed once\n");
 	printf("  --all, -a        Show all potential fixes\n");
 	printf("  --me             Show only fixes for patches I committed\n");
 	printf("  --reverse        Sort fixes in reverse order\n");
@@ -1099,6 +644,62 @@ static void usage(const char *prg)
 	printf("  --domains        Comma-separated list of own domains. If the author\n");
 	printf("                   of the fix has an email address with one of the domains\n");
 	printf("                   specified here, it gets the fix assigned directly.\n");
+	printf("  --stable-range   Range of a stable tree in the base, like v5.14..v5.14.21\n");
+	printf("                   Fixes it backported are not shown (fixes.<db>.stable-range)\n");
+	printf("  --stable-cache   File to cache the stable backports in (defaults to\n");
+	printf("                   ~/.cache/git-fixes/stable-index)\n");
+	printf("  --no-stable-cache\n");
+	printf("                   Don't use the stable backport cache\n");
+	printf("  --trailer        Recognize another trailer, as [<kind>=]<pattern> with\n");
+	printf("                   kind fixes (default), revert, cherry-pick, upstream\n");
+	printf("                   or stable, and %%H for the commit-id (fixes.trailer)\n");
+	printf("  --suse-repo      Read commit-list, blacklist and path-blacklist directly\n");
+	printf("                   from a kernel-source repository instead of --file\n");
+	printf("  --suse-rev       Revision of the kernel-source repository to use\n");
+	printf("                   (defaults to HEAD)\n");
+	printf("  --owners         Assign fixes for Base and Unknown commits to the\n");
+	printf("                   developer the path-map names for their files\n");
+	printf("                   (path-map from fixes.<db>.pathmap)\n");
+	printf("  --path-map       Path-map file to use, implies --owners\n");
+	printf("  --trace          Write a Chrome trace-event file of the run\n");
+	printf("  --perf-counters  Print hardware performance counters per phase\n");
+	printf("                   and per commit scanned\n");
+	printf("  --mem-stats      Print allocations and libgit2 cache size per phase,\n");
+	printf("                   and the peak RSS reached up to each phase\n");
+	printf("  --cache-size     Maximum size of the libgit2 object cache, e.g. 512m\n");
+	printf("                   (fixes.cache-size)\n");
+	printf("  --cache-limit    Largest object of a type to cache, as <type>=<size> with\n");
+	printf("                   type commit, tree, blob or tag (fixes.cache-limit-<type>)\n");
+	printf("  --mwindow-size   Size of the windows packs are mapped with\n");
+	printf("                   (fixes.mwindow-size)\n");
+	printf("  --mwindow-mapped-limit\n");
+	printf("                   Maximum of pack data mapped at once\n");
+	printf("                   (fixes.mwindow-mapped-limit)\n");
+	printf("  --prefetch       Read pack files ahead before the walk (fixes.prefetch)\n");
+	printf("  --no-prefetch    Don't read pack files ahead\n");
+}
+
+/*
+ * Splits <path>[:<revspec>] at the last colon, but only when what follows
+ * is not empty and contains no '/'. Paths with colons, which exist on
+ * disk, are never split.
+ */
+static struct repo_spec parse_repo(const string &arg)
+{
+	struct repo_spec spec;
+	size_t pos = arg.rfind(':');
+	struct stat st;
+
+	spec.path = arg;
+
+	if (pos == string::npos || pos + 1 == arg.length() ||
+	    arg.find('/', pos) != string::npos || stat(arg.c_str(), &st) == 0)
+		return spec;
+
+	spec.path     = arg.substr(0, pos);
+	spec.revision = arg.substr(pos + 1);
+
+	return spec;
 }
 
 static bool parse_options(struct options *opts, int argc, char **argv)
@@ -1120,43 +721,43 @@ static bool parse_options(struct options *opts, int argc, char **argv)
 			break;
 		case OPTION_ALL:
 		case 'a':
-			opts->all         = true;
+			opts->engine.all         = true;
 			opts->all_cmdline = true;
 			break;
 		case OPTION_REPO:
 		case 'r':
-			opts->repo_path = optarg;
+			opts->repos.push_back(parse_repo(optarg));
 			break;
 		case OPTION_ME:
-			opts->all         = false;
+			opts->engine.all         = false;
 			opts->all_cmdline = true;
 			break;
 		case OPTION_REVERSE:
-			opts->reverse = true;
+			opts->engine.reverse = true;
 			break;
 		case OPTION_COMMITTER:
 		case 'c':
-			opts->committer   = optarg;
-			opts->all         = false;
+			opts->engine.committer   = optarg;
+			opts->engine.all         = false;
 			opts->all_cmdline = true;
 			break;
 		case OPTION_GROUPING:
-			opts->no_group = false;
+			opts->engine.no_group = false;
 			break;
 		case OPTION_NO_GROUPING:
-			opts->no_group = true;
+			opts->engine.no_group = true;
 			break;
 		case OPTION_STABLE:
-			opts->stable    = true;
-			opts->no_stable = false;
+			opts->engine.stable    = true;
+			opts->engine.no_stable = false;
 			break;
 		case OPTION_NO_STABLE:
-			opts->stable    = false;
-			opts->no_stable = true;
+			opts->engine.stable    = false;
+			opts->engine.no_stable = true;
 			break;
 		case OPTION_MATCH_ALL:
 		case 'm':
-			opts->match_all = true;
+			opts->engine.match_all = true;
 			break;
 		case OPTION_FILE:
 		case 'f':
@@ -1170,17 +771,13 @@ static bool parse_options(struct options *opts, int argc, char **argv)
 			opts->bl_file = optarg;
 			break;
 		case OPTION_NO_BLACKLIST:
-			opts->no_blacklist = true;
+			opts->engine.no_blacklist = true;
 			break;
 		case OPTION_ADD_BL:
 		case 'B':
 		{
-			string id(optarg);
-
 			opts->write_bl = true;
-			id = to_lower(id);
-			if (is_hex(id))
-				blacklist.push_back(id);
+			opts->bl_add.emplace_back(optarg);
 			break;
 		}
 		case OPTION_DATA_BASE:
@@ -1194,7 +791,7 @@ static bool parse_options(struct options *opts, int argc, char **argv)
 		case OPTION_PARSABLE:
 		case 'p':
 			opts->parsable = true;
-			opts->no_group = true;
+			opts->engine.no_group = true;
 			break;
 		case OPTION_PATH_BLACKLIST:
 			opts->bl_path_file = optarg;
@@ -1203,7 +800,80 @@ static bool parse_options(struct options *opts, int argc, char **argv)
 			opts->patch = true;
 			break;
 		case OPTION_DOMAINS:
-			split_trim(opts->domains, ",", string(optarg), 0);
+			split_trim(opts->engine.domains, ",", string(optarg), 0);
+			break;
+		case OPTION_SUSE_REPO:
+			opts->suse_repo = optarg;
+			break;
+		case OPTION_SUSE_REV:
+			opts->suse_rev = optarg;
+			break;
+		case OPTION_OWNERS:
+			opts->owners = true;
+			break;
+		case OPTION_PATH_MAP:
+			opts->path_map = optarg;
+			opts->owners   = true;
+			break;
+		case OPTION_TRACE:
+			opts->trace_file = optarg;
+			break;
+		case OPTION_PERF_COUNTERS:
+			opts->perf_counters = true;
+			break;
+		case OPTION_MEM_STATS:
+			opts->mem_stats = true;
+			break;
+		case OPTION_CACHE_SIZE:
+			if (tune_parse_size(optarg, opts->tuning.cache_size)) {
+				fprintf(stderr, "Invalid cache size: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPTION_CACHE_LIMIT:
+			if (tune_cache_limit(opts->tuning, optarg)) {
+				fprintf(stderr, "Invalid cache limit: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPTION_MWINDOW_SIZE:
+			if (tune_parse_size(optarg, opts->tuning.mwindow_size)) {
+				fprintf(stderr, "Invalid mwindow size: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPTION_MWINDOW_MAPPED_LIMIT:
+			if (tune_parse_size(optarg, opts->tuning.mwindow_mapped_limit)) {
+				fprintf(stderr, "Invalid mwindow mapped limit: %s\n", optarg);
+				return false;
+			}
+			break;
+		case OPTION_PREFETCH:
+			opts->tuning.prefetch = 1;
+			break;
+		case OPTION_NO_PREFETCH:
+			opts->tuning.prefetch = 0;
+			break;
+		case OPTION_TRAILER: {
+			struct trailer t;
+
+			if (trailer_parse(optarg, t)) {
+				fprintf(stderr, "Invalid trailer: %s\n", optarg);
+				return false;
+			}
+
+			opts->engine.trailers.emplace_back(optarg);
+			break;
+		}
+		case OPTION_STABLE_RANGE:
+			opts->stable_ranges.emplace_back(optarg);
+			break;
+		case OPTION_STABLE_CACHE:
+			opts->stable_cache = optarg;
+			opts->stable_cache_enabled = true;
+			break;
+		case OPTION_NO_STABLE_CACHE:
+			opts->stable_cache_enabled = false;
 			break;
 		default:
 			usage(argv[0]);
@@ -1211,11 +881,14 @@ static bool parse_options(struct options *opts, int argc, char **argv)
 		}
 	}
 
+	if (opts->repos.empty())
+		opts->repos.push_back({ ".", "" });
+
 	if (optind < argc)
 		opts->revision = argv[optind++];
 
 	for (;optind < argc; optind++)
-		opts->path.push_back(argv[optind]);
+		opts->engine.path.push_back(argv[optind]);
 
 	return true;
 }
@@ -1285,12 +958,166 @@ static void bl_path_file(string &filename, git_repository *repo, struct options
 	}
 }
 
+/*
+ * Loads the path-map and ignore-list of the data-base, like git-who does,
+ * for assigning the owners of Base and Unknown fixes.
+ */
+static int load_owners(git_fixes &engine, git_repository *repo,
+		       struct options *opts)
+{
+	string path_map = opts->path_map;
+	git_config *repo_cfg = NULL;
+
+	if (git_repository_config(&repo_cfg, repo) == 0 && opts->db != "") {
+		string key;
+
+		key = "fixes." + opts->db + ".pathmap";
+		if (path_map == "")
+			path_map = config_get_path_nofail(repo_cfg, key.c_str());
+
+		key = "fixes." + opts->db + ".ignore";
+		engine.load_owner_ignore_file(config_get_path_nofail(repo_cfg, key.c_str()));
+	}
+
+	git_config_free(repo_cfg);
+
+	if (path_map == "") {
+		fprintf(stderr, "No path-map for --owners, use --path-map or fixes.<db>.pathmap\n");
+		return -1;
+	}
+
+	return engine.load_path_map(path_map) ? 0 : -1;
+}
+
+static string default_stable_cache(void)
+{
+	const char *dir;
+
+	dir = getenv("XDG_CACHE_HOME");
+	if (dir && *dir)
+		return string(dir) + "/git-fixes/stable-index";
+
+	dir = getenv("HOME");
+	if (!dir || !*dir)
+		return "";
+
+	return string(dir) + "/.cache/git-fixes/stable-index";
+}
+
+/*
+ * Builds the index of fixes already in the stable trees of the base, from
+ * --stable-range or fixes.<db>.stable-range (fixes.stable-range without a
+ * data-base).
+ */
+static int load_stable(git_fixes &engine, git_repository *repo,
+		       struct options *opts)
+{
+	vector<string> ranges = opts->stable_ranges;
+	git_config *repo_cfg = NULL;
+	string cache_file;
+
+	if (git_repository_config(&repo_cfg, repo) < 0)
+		return -1;
+
+	if (ranges.empty()) {
+		string key, range;
+
+		key   = opts->db != "" ? "fixes." + opts->db + ".stable-range"
+				       : "fixes.stable-range";
+		range = config_get_string_nofail(repo_cfg, key.c_str());
+
+		if (range != "")
+			ranges.push_back(range);
+	}
+
+	if (opts->stable_cache == "")
+		opts->stable_cache = config_get_path_nofail(repo_cfg, "fixes.stable-cache");
+
+	git_config_free(repo_cfg);
+
+	if (opts->stable_cache_enabled)
+		cache_file = opts->stable_cache != "" ? opts->stable_cache
+						      : default_stable_cache();
+
+	for (auto &range : ranges) {
+		if (!engine.load_stable_index(repo, range, cache_file))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Loads the data git-suse would write for a kernel-source revision
+ * straight into the engine, so no intermediate files are needed.
+ */
+static int load_suse(git_fixes &engine, struct options *opts)
+{
+	trace_span span("load_suse");
+	vector<struct match_info> commits;
+	vector<struct branch *> branches;
+	struct suse_repo sr;
+	struct branch b;
+	string error_msg;
+	int error;
+
+	sr.cache.filename = suse_default_cache_file();
+	sr.cache.enabled  = (sr.cache.filename != "");
+
+	b.revision = opts->suse_rev;
+	branches.push_back(&b);
+
+	error = suse_repo_open(sr, opts->suse_repo, thread::hardware_concurrency());
+	if (error < 0) {
+		const git_error *e = giterr_last();
+
+		printf("Error: %s\n",
+		       e ? e->message : "Can't open kernel-source repository");
+		return error;
+	}
+
+	suse_load_cache(sr.cache);
+
+	error = suse_load(sr, branches, NULL, error_msg);
+	if (error) {
+		printf("Error: %s\n", error_msg.c_str());
+		goto out;
+	}
+
+	for (auto &r : b.results) {
+		struct match_info info;
+
+		info.commit_id = r.first;
+		info.committer = r.second.context;
+		info.path      = r.second.path;
+
+		commits.emplace_back(info);
+	}
+
+	engine.load_commits(commits);
+	engine.load_blacklist(vector<string>(b.blacklist.begin(), b.blacklist.end()));
+
+	for (auto &path : b.path_blacklist)
+		engine.add_path_blacklist(path);
+
+	suse_save_cache(sr.cache);
+
+out:
+	suse_repo_close(sr);
+
+	return error;
+}
+
 int main(int argc, char **argv)
 {
 	string filename, bl_filename, bl_path_fname;
+	vector<git_repository *> repos;
 	git_repository *repo = NULL;
+	struct perf_values load_start;
+	struct mem_values mem_start;
 	struct options opts;
 	const git_error *e;
+	git_fixes engine;
 	int error;
 
 	git_libgit2_init();
@@ -1301,32 +1128,61 @@ int main(int argc, char **argv)
 	if (!parse_options(&opts, argc, argv))
 		goto out;
 
-	error = git_repository_open(&repo, opts.repo_path.c_str());
+	if (opts.trace_file != "" && trace_open(opts.trace_file)) {
+		fprintf(stderr, "Can't open trace file %s\n", opts.trace_file.c_str());
+		goto out;
+	}
+
+	// Without counters the run goes on, just without the report
+	if (opts.perf_counters && perf_open())
+		perf_read(load_start);
+
+	mem_enabled = opts.mem_stats;
+	mem_read(mem_start);
+
+	// Configuration and data-base come from the first repository
+	error = git_repository_open(&repo, opts.repos[0].path.c_str());
 	if (error < 0)
 		goto error;
 
+	repos.push_back(repo);
+
 	error = load_defaults_from_git(repo, &opts);
 	if (error < 0)
 		goto error;
 
+	tune_load_config(opts.tuning, repo);
+	tune_apply(opts.tuning);
+
 	error = db_file(filename, repo, &opts);
 	if (error)
 		goto error;
 
-	load_ignore_file(opts.ignore_file);
+	opts.engine.alloc_count = alloc_count;
+	if (!engine.set_options(opts.engine)) {
+		fprintf(stderr, "Too many trailers\n");
+		error = 1;
+		goto out;
+	}
+
+	for (auto &id : opts.bl_add)
+		engine.add_blacklist(id);
+
+	if (!engine.load_ignore_file(opts.ignore_file))
+		printf("Can't open ignore-file: %s\n", opts.ignore_file.c_str());
 
 	bl_file(bl_filename, repo, &opts);
-	load_blacklist_file(bl_filename);
+	engine.load_blacklist_file(bl_filename);
 
 	bl_path_file(bl_path_fname, repo, &opts);
-	load_bl_path_file(bl_path_fname, &opts);
+	engine.load_path_blacklist_file(bl_path_fname);
 
 	if (opts.write_bl) {
 		bool ret;
 
-		sanitize_blacklist(repo);
+		engine.sanitize_blacklist(repo);
 
-		ret = write_blacklist_file(bl_filename);
+		ret = engine.write_blacklist_file(bl_filename);
 
 		if (!ret) {
 			fprintf(stderr, "Can't write blacklist file: %s\n",
@@ -1339,23 +1195,66 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	if (!load_commit_file(filename.c_str(), match_list))
+	// Only needed for the walk, not for writing the blacklist
+	if (opts.owners && load_owners(engine, repo, &opts)) {
+		error = 1;
 		goto out;
+	}
 
-	error = fixes(repo, &opts);
-	if (error < 0)
-		goto error;
+	if (load_stable(engine, repo, &opts)) {
+		error = 1;
+		goto out;
+	}
+
+	if (opts.suse_repo != "") {
+		if (load_suse(engine, &opts)) {
+			error = 1;
+			goto out;
+		}
+	} else if (filename == "") {
+		printf("No file given to load commit-list from.\n");
+		printf("Either use the -f option or set the fixes.file config variable in git.\n");
+		goto out;
+	} else if (!engine.load_commit_file(filename)) {
+		printf("Can't open file '%s'\n", filename.c_str());
+		goto out;
+	}
+
+	if (perf_enabled)
+		perf_add_phase("load", load_start);
+
+	if (mem_enabled)
+		mem_add_phase("load", mem_start);
+
+	for (size_t i = 1; i < opts.repos.size(); ++i) {
+		git_repository *r;
+
+		error = git_repository_open(&r, opts.repos[i].path.c_str());
+		if (error < 0)
+			goto error;
+
+		repos.push_back(r);
+	}
+
+	error = fixes(engine, repos, &opts);
 
 out:
-	git_repository_free(repo);
+	// Holds repo once it is open
+	for (auto r : repos)
+		git_repository_free(r);
 
 	git_libgit2_shutdown();
 
+	perf_close();
+
+	if (trace_close())
+		error = 1;
+
 	return error;
 
 error:
 	e = giterr_last();
-	printf("Error: %s\n", e->message);
+	printf("Error: %s\n", e ? e->message : "Unknown libgit2 error");
 
 	goto out;
 }
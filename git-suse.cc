@@ -12,423 +12,57 @@
 
 #include <algorithm>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
 #include <vector>
 #include <map>
-#include <set>
+#include <thread>
 
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <getopt.h>
 #include <git2.h>
 
+#include "output.h"
+#include "pathmap.h"
+#include "mem.h"
+#include "trace.h"
+#include "tune.h"
+#include "suse.h"
+
 using namespace std;
 
 /* Options */
 string path_blacklist_file;
-string revision = "HEAD";
+vector<string> revisions;
 string repo_path = ".";
 bool diff_mode = false;
 string blacklist_file;
 string path_map_file;
+bool compact_path_map;
+bool binary_path_map;
 bool std_out = false;
 bool append = false;
 string file_name;
 string base_rev;
 string base_file;
-
-map<string, map<string, int> > path_map;
-
-typedef map<string, git_oid> oid_map_t;
-oid_map_t file_oid_map;
-
-struct patch_info {
-	string context;
-	string path;
-};
-
-using results_type = map<string, patch_info>;
-
-static bool is_hex(const string &s)
-{
-	for (string::const_iterator c = s.begin(); c != s.end(); ++c) {
-		if (!isxdigit(*c))
-			return false;
-	}
-
-	return true;
-}
-
-static string to_lower(string s)
-{
-	transform(s.begin(), s.end(), s.begin(), ::tolower);
-
-	return s;
-}
-
-string trim(const string &line)
-{
-	static const char *spaces = " \n\t\r";
-	size_t pos1, pos2;
-
-	pos1 = line.find_first_not_of(spaces);
-	pos2 = line.find_last_not_of(spaces);
-
-	if (pos1 == string::npos)
-		return string("");
-
-	return line.substr(pos1, pos2-pos1+1);
-}
-
-static int split_trim(vector<string> &items, const char *delim,
-		      string buffer, unsigned splits)
-{
-	unsigned num;
-	string item;
-	size_t pos;
-
-	buffer = trim(buffer);
-
-	num = 0;
-	pos = 0;
-
-	while (pos != std::string::npos) {
-		pos = buffer.find_first_of(delim, 0);
-		if (pos == string::npos) {
-			item = buffer;
-		} else {
-			item   = buffer.substr(0, pos);
-			buffer = buffer.substr(pos + 1);
-		}
-
-		num += 1;
-		items.push_back(trim(item));
-
-		if (splits && num == splits)
-			break;
-	}
-
-	return num;
-}
-
-static const char *domains[] = {
-	"suse.de",
-	"suse.cz",
-	"suse.com",
-	"novell.com",
-	0,
+unsigned jobs;
+string cache_file;
+bool cache_enabled = true;
+string trace_file;
+bool mem_stats;
+struct git_tuning tuning;
+
+static const char *path_map_compact_magic = "# git-suse path-map compact v1";
+
+/* Files the data of one revision is written to */
+struct branch_files {
+	string list;
+	string blacklist;
+	string path_blacklist;
+	string path_map;
 };
 
-static bool is_suse_email(const string &email)
-{
-	size_t pos = email.find_first_of("@");
-
-	if (pos == string::npos)
-		return false;
-
-	string domain = email.substr(pos + 1);
-
-	for (const char **c = domains; *c; ++c) {
-		if (to_lower(domain) == *c)
-			return true;
-	}
-
-	return false;
-}
-
-static int blob_content(string& content, const string &path,
-		 git_repository *repo, git_tree *tree)
-{
-	git_blob *blob;
-	int error;
-
-	content.clear();
-
-	auto oid_it = file_oid_map.find(path);
-	if (oid_it == file_oid_map.end()) {
-		giterr_set_str(GIT_ENOTFOUND, "Path not found");
-		return GIT_ENOTFOUND;
-	}
-
-	error = git_blob_lookup(&blob, repo, &oid_it->second);
-	if (error)
-		return error;
-
-	content = (const char *)git_blob_rawcontent(blob);
-
-	git_blob_free(blob);
-
-	return error;
-}
-
-static void parse_patch(const string &path,
-			git_repository *repo, git_tree *tree,
-			results_type &results,
-			set<string> &blacklist)
-{
-	string committer = "Unknown";
-	vector<string> commit_ids;
-	bool in_patch = false;
-	string content;
-	int error;
-
-	error = blob_content(content, path, repo, tree);
-	if (error)
-		return;
-
-	istringstream is(content);
-	string line;
-
-	while (getline(is, line)) {
-		size_t len, pos;
-		string token;
-
-		if (line == "---") {
-			in_patch = true;
-			if (path_map_file == "")
-				break;
-		}
-
-		if (in_patch) {
-			if (line.length() < 5)
-				continue;
-
-			string prefix = line.substr(0, 4);
-
-			if (prefix != "+++ ")
-				continue;
-
-			string path = line.substr(4);
-			auto pos = path.find_first_of("/");
-
-			if (pos != string::npos)
-				path = path.substr(pos + 1);
-
-			pos = path.find_first_of(" ");
-			if (pos != string::npos)
-				path = path.substr(0, pos);
-
-			while (true) {
-				path_map[path][committer] += 1;
-
-				pos = path.find_last_of("/");
-				if (pos == string::npos)
-					break;
-
-				path = path.substr(0, pos);
-			}
-
-			continue;
-		}
-
-		len = line.length();
-		pos = line.find_first_of(":");
-		if (pos == string::npos || pos + 1 >= len)
-			continue;
-
-		token = to_lower(line.substr(0, pos));
-
-		if (token == "git-commit" || token == "no-fix" ||
-		    token == "alt-commit") {
-			string id;
-
-			pos = line.find_first_not_of(" ", pos + 1);
-			if (pos == string::npos)
-				continue;
-
-			line = to_lower(line);
-			auto pos2 = line.find_first_not_of("0123456789abcdef",
-							   pos);
-			if (pos2 == string::npos)
-				pos2 = line.length();
-
-			if (pos2 - pos != 40)
-				continue;
-
-			id = line.substr(pos, pos2 - pos);
-			if (token == "git-commit" || token == "alt-commit")
-				commit_ids.emplace_back(id);
-			else
-				blacklist.emplace(id);
-
-		} else if (token == "signed-off-by" || token == "acked-by" ||
-			   token == "reviewed-by") {
-			vector<string> items;
-
-			split_trim(items, " \t", line, 0);
-
-			for (vector<string>::iterator it = items.begin();
-			     it != items.end();
-			     ++it) {
-				string email;
-
-				pos = it->find_first_of("@", 0);
-				len = it->length();
-				if (!len || pos == string::npos)
-					continue;
-
-				email = *it;
-
-				if (email[0] == '<') {
-					email = email.substr(1);
-					len -= 1;
-				}
-
-				if (!len)
-					continue;
-
-				if (email[len - 1] == '>')
-					email = email.substr(0, len - 1);
-
-				if (is_suse_email(email))
-					committer = email;
-			}
-		}
-	}
-
-	auto pos = path.find_first_of("/");
-	if (pos != std::string::npos) {
-		auto directory = path.substr(0, pos);
-
-		// Count patches in "patches.kernel.org" directory
-		// as Base fixes
-		if (directory == "patches.kernel.org")
-			committer = "Base";
-
-	}
-
-	for (auto &it : commit_ids) {
-		results[it].context = committer;
-		results[it].path = path;
-	}
-}
-
-static void parse_blacklist(string &content,
-			    set<string> &blacklist,
-			    vector<string> &path_blacklist)
-{
-	istringstream is(content);
-	string line;
-
-	while (getline(is, line)) {
-
-		line = trim(line);
-
-		auto pos = line.find_first_of("# \n\t\r");
-
-		if (pos != string::npos)
-			line = line.substr(0, pos);
-
-		if (line.length() == 40 && is_hex(line))
-			blacklist.emplace(to_lower(line));
-		else if (line.length() > 0)
-			path_blacklist.emplace_back(line);
-	}
-}
-
-static void parse_series(const string& series,
-			 git_repository *repo, git_tree *tree,
-			 results_type &results,
-			 set<string> &blacklist)
-{
-	istringstream is(series);
-	string line;
-
-	while (getline(is, line)) {
-		vector<string> items;
-		string path;
-		size_t pos;
-
-		pos = line.find_first_of("#", 0);
-		if (pos != string::npos)
-			line = line.substr(0, pos);
-
-		split_trim(items, " \t", line, 0);
-
-		for (vector<string>::iterator it = items.begin();
-		     it != items.end();
-		     ++it) {
-			if (it->find_first_of("/", 0) != string::npos) {
-				path = *it;
-				break;
-			}
-		}
-
-		if (!path.length())
-			continue;
-
-		parse_patch(path, repo, tree, results, blacklist);
-	}
-}
-
-static int fill_file_oid_map(const char *root, const git_tree_entry *entry,
-			     void *payload)
-{
-	if (git_tree_entry_type(entry) == GIT_OBJ_BLOB) {
-		string path(root);
-		path += git_tree_entry_name(entry);
-
-		oid_map_t &map = *(oid_map_t*)payload;
-		map[path] = *git_tree_entry_id(entry);
-	}
-
-	return 0;
-}
-
-static int handle_revision(git_repository *repo, const char *revision,
-			   const string& outfile,
-			   results_type &results,
-			   set<string> &blacklist,
-			   vector<string> &path_blacklist)
-{
-	git_commit *commit;
-	git_object *obj;
-	git_tree *tree;
-	string series;
-	string blist;
-	int error;
-
-	error = git_revparse_single(&obj, repo, revision);
-	if (error < 0)
-		goto out;
-
-	error = git_commit_lookup(&commit, repo, git_object_id(obj));
-	if (error)
-		goto out_obj_free;
-
-	error = git_commit_tree(&tree, commit);
-	if (error)
-		goto out_commit_free;
-
-	file_oid_map.clear();
-	error = git_tree_walk(tree, GIT_TREEWALK_PRE,
-			      fill_file_oid_map, &file_oid_map);
-	if (error)
-		goto out_free_tree;
-
-	error = blob_content(blist, "blacklist.conf", repo, tree);
-	if (!error)
-		parse_blacklist(blist, blacklist, path_blacklist);
-
-	error = blob_content(series, "series.conf", repo, tree);
-	if (error)
-		goto out_free_tree;
-
-	parse_series(series, repo, tree, results, blacklist);
-
-out_free_tree:
-	git_tree_free(tree);
-
-out_commit_free:
-	git_commit_free(commit);
-
-out_obj_free:
-	git_object_free(obj);
-
-out:
-	return error;
-}
-
 static string base_name(const string &s)
 {
 	size_t pos = s.find_last_of("/");
@@ -450,6 +84,19 @@ enum {
 	OPTION_PATH_BLACKLIST,
 	OPTION_PATH_MAP,
 	OPTION_BASE_FILE,
+	OPTION_JOBS,
+	OPTION_CACHE,
+	OPTION_NO_CACHE,
+	OPTION_COMPACT_PATH_MAP,
+	OPTION_BINARY_PATH_MAP,
+	OPTION_TRACE,
+	OPTION_MEM_STATS,
+	OPTION_CACHE_SIZE,
+	OPTION_CACHE_LIMIT,
+	OPTION_MWINDOW_SIZE,
+	OPTION_MWINDOW_MAPPED_LIMIT,
+	OPTION_PREFETCH,
+	OPTION_NO_PREFETCH,
 };
 
 static struct option options[] = {
@@ -463,12 +110,25 @@ static struct option options[] = {
 	{ "path-blacklist",	required_argument,	0, OPTION_PATH_BLACKLIST },
 	{ "path-map",		required_argument,	0, OPTION_PATH_MAP       },
 	{ "base-file",		required_argument,	0, OPTION_BASE_FILE      },
+	{ "jobs",		required_argument,	0, OPTION_JOBS           },
+	{ "cache",		required_argument,	0, OPTION_CACHE          },
+	{ "no-cache",		no_argument,		0, OPTION_NO_CACHE       },
+	{ "compact-path-map",	no_argument,		0, OPTION_COMPACT_PATH_MAP },
+	{ "binary-path-map",	no_argument,		0, OPTION_BINARY_PATH_MAP },
+	{ "trace",		required_argument,	0, OPTION_TRACE          },
+	{ "mem-stats",		no_argument,		0, OPTION_MEM_STATS      },
+	{ "cache-size",		required_argument,	0, OPTION_CACHE_SIZE     },
+	{ "cache-limit",	required_argument,	0, OPTION_CACHE_LIMIT    },
+	{ "mwindow-size",	required_argument,	0, OPTION_MWINDOW_SIZE   },
+	{ "mwindow-mapped-limit", required_argument,	0, OPTION_MWINDOW_MAPPED_LIMIT },
+	{ "prefetch",		no_argument,		0, OPTION_PREFETCH       },
+	{ "no-prefetch",	no_argument,		0, OPTION_NO_PREFETCH    },
 	{ 0,			0,			0, 0                     }
 };
 
 static void usage(const char *prg)
 {
-	printf("Usage: %s [Options] Revision\n", base_name(prg).c_str());
+	printf("Usage: %s [Options] Revision...\n", base_name(prg).c_str());
 	printf("Options:\n");
 	printf("  --help, -h       Print this message end exit\n");
 	printf("  --repo, -r       Path to git repository\n");
@@ -476,11 +136,54 @@ static void usage(const char *prg)
 	printf("  --blacklist      Write blacklist to specified file\n");
 	printf("  --path-blacklist Write path-blacklist to specified file\n");
 	printf("  --path-map       Write path-map to specified file\n");
+	printf("  --compact-path-map\n");
+	printf("                   Only write counts of touched paths to the\n");
+	printf("                   path-map, git-who computes the directory sums\n");
+	printf("  --binary-path-map\n");
+	printf("                   Write the path-map in a binary format git-who can\n");
+	printf("                   map into memory instead of parsing it\n");
 	printf("  --base, -b       Show only commits not in given base version\n");
 	printf("  --base-file      File to store commit-list from the base-kernel\n");
 	printf("                   (Only used when --base is specified)\n");
 	printf("  --append         Open output file in append mode\n");
 	printf("  --stdout, -c     Write output to stdout\n");
+	printf("  --jobs, -j       Number of threads parsing patches\n");
+	printf("                   (defaults to the number of CPUs)\n");
+	printf("  --cache          File to cache parsed patches in (defaults to\n");
+	printf("                   ~/.cache/git-suse/patches)\n");
+	printf("  --no-cache       Don't use the patch cache\n");
+	printf("  --trace          Write a Chrome trace-event file of the run\n");
+	printf("  --mem-stats      Print allocations and libgit2 cache size per phase,\n");
+	printf("                   and the peak RSS reached up to each phase, to stderr\n");
+	printf("  --cache-size     Maximum size of the libgit2 object cache, e.g. 512m\n");
+	printf("  --cache-limit    Largest object of a type to cache, as <type>=<size>\n");
+	printf("  --mwindow-size   Size of the windows packs are mapped with\n");
+	printf("  --mwindow-mapped-limit\n");
+	printf("                   Maximum of pack data mapped at once\n");
+	printf("  --prefetch       Read pack files ahead before loading the patches\n");
+	printf("  --no-prefetch    Don't read pack files ahead\n");
+	printf("\n");
+	printf("When more than one revision is given, all of them are processed\n");
+	printf("together. A %%b in the file names is replaced by the base name of\n");
+	printf("each revision, e.g. '-f %%b.list --blacklist %%b.blacklist'.\n");
+}
+
+static bool parse_jobs(const char *arg, unsigned &jobs)
+{
+	unsigned long val;
+	char *end;
+
+	if (*arg == '-')
+		return false;
+
+	errno = 0;
+	val = strtoul(arg, &end, 10);
+	if (errno || end == arg || *end || !val || val > SUSE_MAX_JOBS)
+		return false;
+
+	jobs = val;
+
+	return true;
 }
 
 static void parse_options(int argc, char **argv)
@@ -495,7 +198,7 @@ static void parse_options(int argc, char **argv)
 	while (true) {
 		int opt_idx;
 
-		c = getopt_long(argc, argv, "hr:f:b:c", options, &opt_idx);
+		c = getopt_long(argc, argv, "hr:f:b:cj:", options, &opt_idx);
 		if (c == -1)
 			break;
 
@@ -537,93 +240,370 @@ static void parse_options(int argc, char **argv)
 		case OPTION_PATH_MAP:
 			path_map_file = optarg;
 			break;
+		case OPTION_JOBS:
+		case 'j':
+			if (!parse_jobs(optarg, jobs)) {
+				fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPTION_CACHE:
+			cache_file    = optarg;
+			cache_enabled = true;
+			break;
+		case OPTION_NO_CACHE:
+			cache_enabled = false;
+			break;
+		case OPTION_COMPACT_PATH_MAP:
+			compact_path_map = true;
+			break;
+		case OPTION_BINARY_PATH_MAP:
+			binary_path_map = true;
+			break;
+		case OPTION_TRACE:
+			trace_file = optarg;
+			break;
+		case OPTION_MEM_STATS:
+			mem_stats = true;
+			break;
+		case OPTION_CACHE_SIZE:
+			if (tune_parse_size(optarg, tuning.cache_size)) {
+				fprintf(stderr, "Invalid cache size: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPTION_CACHE_LIMIT:
+			if (tune_cache_limit(tuning, optarg)) {
+				fprintf(stderr, "Invalid cache limit: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPTION_MWINDOW_SIZE:
+			if (tune_parse_size(optarg, tuning.mwindow_size)) {
+				fprintf(stderr, "Invalid mwindow size: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPTION_MWINDOW_MAPPED_LIMIT:
+			if (tune_parse_size(optarg, tuning.mwindow_mapped_limit)) {
+				fprintf(stderr, "Invalid mwindow mapped limit: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPTION_PREFETCH:
+			tuning.prefetch = 1;
+			break;
+		case OPTION_NO_PREFETCH:
+			tuning.prefetch = 0;
+			break;
 		default:
 			usage(argv[0]);
 			exit(1);
 		}
 	}
 
-	if (optind < argc)
-		revision = argv[optind++];
+	while (optind < argc)
+		revisions.emplace_back(argv[optind++]);
+
+	if (revisions.empty())
+		revisions.emplace_back("HEAD");
 }
 
-static void write_blacklist(set<string> &blacklist)
+/* Replaces every %b in the file name template with the revision base name */
+static string expand_name(const string &tmpl, const string &rev)
 {
-	ofstream file;
+	string ret = tmpl;
+	size_t pos = 0;
 
-	if (blacklist_file == "")
-		return;
+	while ((pos = ret.find("%b", pos)) != string::npos) {
+		string name = base_name(rev);
+
+		ret.replace(pos, 2, name);
+		pos += name.length();
+	}
+
+	return ret;
+}
+
+static bool check_name(const string &tmpl, const char *option)
+{
+	if (tmpl == "" || revisions.size() < 2 ||
+	    tmpl.find("%b") != string::npos)
+		return true;
+
+	cerr << "The " << option << " file name needs to contain %b when "
+	     << "more than one revision is given" << endl;
+
+	return false;
+}
+
+static int commit_file(output_file &file, const string &filename)
+{
+	if (!file.commit())
+		return 0;
+
+	cerr << "Can't write " << filename << ": " << strerror(errno) << endl;
 
-	file.open(blacklist_file.c_str());
+	return 1;
+}
+
+static void write_blacklist(const struct branch &b, const string &filename)
+{
+	output_file file;
 
-	if (!file.is_open()) {
+	if (filename == "")
+		return;
+
+	if (file.open(filename)) {
 		fprintf(stderr, "Can't open blacklist file for writing\n");
 		return;
 	}
 
-	for (auto &c : blacklist)
-		file << c << std::endl;
+	for (auto &c : b.blacklist)
+		file << c << '\n';
 
-	cout << "Wrote " << blacklist.size() << " blacklisted commits to " << blacklist_file << endl;
+	if (commit_file(file, filename))
+		return;
 
-	file.close();
+	cout << "Wrote " << b.blacklist.size() << " blacklisted commits to " << filename << endl;
 }
 
-static void write_path_blacklist(vector<string> &path_blacklist)
+static void write_path_blacklist(const struct branch &b, const string &filename)
 {
-	ofstream file;
+	output_file file;
 
-	if (path_blacklist_file == "")
+	if (filename == "")
 		return;
 
-	file.open(path_blacklist_file.c_str());
-
-	if (!file.is_open()) {
+	if (file.open(filename)) {
 		fprintf(stderr, "Can't open path-blacklist file for writing\n");
 		return;
 	}
 
-	for (auto &path : path_blacklist)
-		file << path << std::endl;
+	for (auto &path : b.path_blacklist)
+		file << path << '\n';
 
-	cout << "Wrote " << path_blacklist.size() << " blacklisted paths to "
-	     << path_blacklist_file << endl;
+	if (commit_file(file, filename))
+		return;
 
-	file.close();
+	cout << "Wrote " << b.path_blacklist.size() << " blacklisted paths to "
+	     << filename << endl;
 }
 
-static void write_results(ostream &os, results_type &results)
+static void write_results(output_file &file, const results_type &results)
 {
 	for (auto &it : results) {
-		os << it.first << ',' << it.second.context;
+		file << it.first << ',' << it.second.context;
 		if (it.second.path.length() > 0)
-			os << ',' << it.second.path;
-		os << endl;
+			file << ',' << it.second.path;
+		file << '\n';
+	}
+}
+
+/* Node counts of the trie, with the counts of directories rolled up */
+static void path_map_counts(const struct path_trie &trie,
+			    vector<vector<struct path_count> > &counts,
+			    bool rollup)
+{
+	counts.resize(trie.nodes.size());
+	for (unsigned i = 1; i < trie.nodes.size(); ++i)
+		counts[i] = trie.nodes[i].counts;
+
+	// Children have higher indexes, so this sums up bottom-up
+	for (unsigned i = trie.nodes.size() - 1; i > 0; --i) {
+		unsigned parent = trie.nodes[i].parent;
+
+		if (!rollup || !parent)
+			continue;
+
+		for (auto &c : counts[i])
+			add_count(counts[parent], c.committer, c.count);
 	}
 }
 
-static void write_path_map(string filename)
+/*
+ * Writes one line per path with the counts of all committers. Without
+ * --compact-path-map the counts of each directory include everything
+ * below it, in compact mode only paths touched by patches are written
+ * and readers do the rollup.
+ */
+static void write_path_map(const struct branch &b, const string &filename)
 {
-	ofstream file;
+	const struct path_trie &trie = b.path_map;
+	vector<vector<struct path_count> > counts;
+	vector<unsigned> order;
+	vector<string> paths;
+	output_file file;
 
 	if (filename == "")
 		return;
 
-	file.open(filename.c_str());
+	if (file.open(filename)) {
+		fprintf(stderr, "Can't open path-map file for writing\n");
+		return;
+	}
+
+	// Parents are always created before their children
+	paths.resize(trie.nodes.size());
+	for (unsigned i = 1; i < trie.nodes.size(); ++i) {
+		const struct path_node &n = trie.nodes[i];
+
+		paths[i] = n.parent ? paths[n.parent] + '/' + n.name : n.name;
+	}
+
+	path_map_counts(trie, counts, !compact_path_map);
+
+	for (unsigned i = 1; i < trie.nodes.size(); ++i) {
+		if (!counts[i].empty())
+			order.push_back(i);
+	}
+
+	sort(order.begin(), order.end(), [&](unsigned x, unsigned y) {
+		return paths[x] < paths[y];
+	});
+
+	if (compact_path_map)
+		file << path_map_compact_magic << '\n';
+
+	for (auto i : order) {
+		auto &c = counts[i];
+
+		sort(c.begin(), c.end(), [&](const struct path_count &x,
+					     const struct path_count &y) {
+			return trie.committers[x.committer] <
+			       trie.committers[y.committer];
+		});
 
-	if (!file.is_open()) {
+		file << paths[i];
+		for (auto &m : c)
+			file << ';' << trie.committers[m.committer] << ':' << m.count;
+		file << '\n';
+	}
+
+	commit_file(file, filename);
+}
+
+static uint32_t add_string(string &table, map<string, uint32_t> &offsets,
+			   const string &str)
+{
+	auto it = offsets.find(str);
+
+	if (it != offsets.end())
+		return it->second;
+
+	uint32_t off = table.length();
+
+	table.append(str.c_str(), str.length() + 1);
+	offsets[str] = off;
+
+	return off;
+}
+
+static void write_section(output_file &file, uint64_t &off, const void *data,
+			  size_t size)
+{
+	static const char zeros[8] = { 0 };
+
+	file.write(static_cast<const char *>(data), size);
+	off += size;
+
+	// Keep every section 8-byte aligned
+	file.write(zeros, (8 - off % 8) % 8);
+	off += (8 - off % 8) % 8;
+}
+
+/*
+ * Writes the path-map in the binary format described in pathmap.h. The
+ * trie is written as it is, node indexes stay the same.
+ */
+static void write_binary_path_map(const struct branch &b, const string &filename)
+{
+	const struct path_trie &trie = b.path_map;
+	vector<vector<struct path_count> > counts;
+	vector<uint32_t> children, names, ids;
+	map<string, uint32_t> offsets;
+	vector<struct pm_score> scores;
+	vector<struct pm_node> nodes;
+	vector<unsigned> order;
+	struct pm_header hdr;
+	output_file file;
+	string strings;
+	uint64_t off;
+
+	if (filename == "")
+		return;
+
+	if (file.open(filename)) {
 		fprintf(stderr, "Can't open path-map file for writing\n");
 		return;
 	}
 
-	for (auto &path : path_map) {
-		file << path.first;
-		for (auto &m : path.second)
-			file << ';' << m.first << ":" << m.second;
-		file << endl;
+	path_map_counts(trie, counts, true);
+
+	// Developer ids are handed out in name order
+	for (unsigned i = 0; i < trie.committers.size(); ++i)
+		order.push_back(i);
+
+	sort(order.begin(), order.end(), [&](unsigned x, unsigned y) {
+		return trie.committers[x] < trie.committers[y];
+	});
+
+	ids.resize(order.size());
+	for (unsigned i = 0; i < order.size(); ++i) {
+		ids[order[i]] = i;
+		names.push_back(add_string(strings, offsets, trie.committers[order[i]]));
 	}
 
-	file.close();
+	for (unsigned i = 0; i < trie.nodes.size(); ++i) {
+		const struct path_node &n = trie.nodes[i];
+		struct pm_node node = {};
+
+		sort(counts[i].begin(), counts[i].end(),
+		     [&](const struct path_count &x, const struct path_count &y) {
+			return ids[x.committer] < ids[y.committer];
+		     });
+
+		node.name        = add_string(strings, offsets, n.name);
+		node.name_len    = n.name.length();
+		node.first_child = children.size();
+		node.nr_children = n.children.size();
+		node.first_score = scores.size();
+		node.nr_scores   = counts[i].size();
+		node.flags       = counts[i].empty() ? 0 : PM_NODE_KNOWN;
+
+		for (auto &c : n.children)
+			children.push_back(c.second);
+
+		for (auto &c : counts[i])
+			scores.push_back({ ids[c.committer], (int32_t)c.count });
+
+		nodes.push_back(node);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PM_MAGIC, sizeof(hdr.magic));
+	hdr.version      = PM_VERSION;
+	hdr.byte_order   = PM_BYTE_ORDER;
+	hdr.nr_nodes     = nodes.size();
+	hdr.nr_children  = children.size();
+	hdr.nr_scores    = scores.size();
+	hdr.nr_names     = names.size();
+	hdr.nodes_off    = sizeof(hdr);
+	hdr.children_off = hdr.nodes_off    + nodes.size() * sizeof(struct pm_node);
+	hdr.scores_off   = hdr.children_off + (children.size() * 4 + 7) / 8 * 8;
+	hdr.names_off    = hdr.scores_off   + scores.size() * sizeof(struct pm_score);
+	hdr.strings_off  = hdr.names_off    + (names.size() * 4 + 7) / 8 * 8;
+	hdr.strings_size = strings.length();
+
+	off = 0;
+	write_section(file, off, &hdr, sizeof(hdr));
+	write_section(file, off, nodes.data(), nodes.size() * sizeof(struct pm_node));
+	write_section(file, off, children.data(), children.size() * 4);
+	write_section(file, off, scores.data(), scores.size() * sizeof(struct pm_score));
+	write_section(file, off, names.data(), names.size() * 4);
+	write_section(file, off, strings.data(), strings.length());
+
+	commit_file(file, filename);
 }
 
 static void do_diff(results_type &result,
@@ -636,101 +616,160 @@ static void do_diff(results_type &result,
 	}
 }
 
+static int write_branch(const struct branch &b, const struct branch_files &f)
+{
+	trace_span span("write_branch");
+	output_file file;
+
+	if (std_out) {
+		file.open_stdout();
+	} else if (file.open(f.list, append)) {
+		cerr << "Can't open output file " << f.list << endl;
+		return 1;
+	}
+
+	write_results(file, b.results);
+
+	if (commit_file(file, std_out ? "<stdout>" : f.list))
+		return 1;
+
+	if (!std_out)
+		cout << "Wrote " << b.results.size() << " commits to " << f.list << endl;
+
+	write_blacklist(b, f.blacklist);
+	write_path_blacklist(b, f.path_blacklist);
+	if (binary_path_map)
+		write_binary_path_map(b, f.path_map);
+	else
+		write_path_map(b, f.path_map);
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
-	ios_base::openmode file_mode = ios_base::out;
-	results_type results, base;
-	vector<string> path_blacklist;
-	git_repository *repo = NULL;
-	set<string> blacklist;
-	const git_error *e;
-	ofstream of;
-	ostream *os;
+	vector<struct branch_files> files;
+	vector<struct branch *> all;
+	vector<struct branch> branches;
+	struct suse_repo sr;
+	struct branch base;
+	string error_msg;
 	int error;
 
+	jobs = thread::hardware_concurrency();
+
 	parse_options(argc, argv);
 
-	if (file_name == "")
-		file_name = base_name(revision) + ".list";
+	if (!check_name(file_name, "--file") ||
+	    !check_name(blacklist_file, "--blacklist") ||
+	    !check_name(path_blacklist_file, "--path-blacklist") ||
+	    !check_name(path_map_file, "--path-map"))
+		return 1;
 
-	if (append)
-		file_mode |= ofstream::app;
+	if (cache_file == "")
+		cache_file = suse_default_cache_file();
 
-	if (!std_out) {
-		of.open(file_name.c_str(), file_mode);
-		if (!of.is_open()) {
-			cerr << "Can't open output file " << file_name << endl;
-			error = 1;
-			goto out;
-		}
+	sr.cache.filename = cache_file;
+	sr.cache.enabled  = cache_enabled && cache_file != "";
 
-		os = &of;
-	} else {
-		os = &cout;
-	}
+	sr.need_paths = (path_map_file != "");
 
-	git_libgit2_init();
+	branches.resize(revisions.size());
+	files.resize(revisions.size());
+	for (size_t i = 0; i < revisions.size(); ++i) {
+		struct branch_files &f = files[i];
+		struct branch &b = branches[i];
+
+		b.revision         = revisions[i];
+		f.list             = file_name == "" ? base_name(b.revision) + ".list"
+						 : expand_name(file_name, b.revision);
+		f.blacklist        = expand_name(blacklist_file, b.revision);
+		f.path_blacklist   = expand_name(path_blacklist_file, b.revision);
+		f.path_map         = expand_name(path_map_file, b.revision);
+		b.need_all         = (f.blacklist != "" || f.path_map != "");
+		b.need_path_map    = (f.path_map != "");
 
-	error = git_repository_open(&repo, repo_path.c_str());
-	if (error < 0)
-		goto error;
+		all.push_back(&b);
+	}
 
 	if (diff_mode) {
-		vector<string> ignored2;
-		set<string> ignored;
+		base.revision = base_rev;
 
-		error = handle_revision(repo, base_rev.c_str(), file_name, base,
-					ignored, ignored2);
-		if (error)
-			goto error;
+		for (auto &b : branches)
+			b.parent = &base;
 	}
 
-	error = handle_revision(repo, revision.c_str(), file_name,
-				results, blacklist, path_blacklist);
-	if (error)
-		goto error;
+	if (trace_file != "" && trace_open(trace_file)) {
+		cerr << "Can't open trace file " << trace_file << endl;
+		return 1;
+	}
 
-	if (diff_mode) {
-		results_type r;
+	mem_enabled = mem_stats;
 
-		do_diff(r, base, results);
+	git_libgit2_init();
 
-		results = r;
+	error = suse_repo_open(sr, repo_path, jobs);
+	if (error < 0) {
+		const git_error *e = giterr_last();
 
-		if (base_file != "") {
-			ofstream bof(base_file);
+		cout << "Error: " << (e ? e->message : "Can't open repository") << endl;
+		goto out;
+	}
 
-			if (bof.is_open()) {
-				write_results(bof, base);
-				cout << "Wrote " << base.size() << " commits to " << base_file << endl;
-			} else {
-				cerr << "Can't open " << base_file << " for writing" << endl;
-			}
+	tune_load_config(tuning, sr.repos[0]);
+	tune_apply(tuning);
+
+	if (tuning.prefetch > 0)
+		tune_prefetch(sr.repos[0]);
+
+	suse_load_cache(sr.cache);
+
+	error = suse_load(sr, all, diff_mode ? &base : NULL, error_msg);
+	if (error) {
+		cout << "Error: " << error_msg << endl;
+		goto out;
+	}
+
+	if (diff_mode && base_file != "") {
+		output_file bof;
+
+		if (!bof.open(base_file)) {
+			write_results(bof, base.results);
+			if (!commit_file(bof, base_file))
+				cout << "Wrote " << base.results.size() << " commits to " << base_file << endl;
+		} else {
+			cerr << "Can't open " << base_file << " for writing" << endl;
 		}
 	}
 
-	write_results(*os, results);
+	for (size_t i = 0; i < branches.size(); ++i) {
+		mem_phase phase("write_branches");
+		struct branch &b = branches[i];
 
-	if (!std_out)
-		cout << "Wrote " << results.size() << " commits to " << file_name << endl;
+		if (diff_mode) {
+			results_type r;
 
-	write_blacklist(blacklist);
-	write_path_blacklist(path_blacklist);
-	write_path_map(path_map_file);
+			do_diff(r, base.results, b.results);
+
+			b.results = r;
+		}
+
+		if (write_branch(b, files[i]))
+			error = 1;
+	}
+
+	suse_save_cache(sr.cache);
 
 out:
-	if (of.is_open())
-		of.close();
+	// stdout may carry the commit-list
+	mem_report(stderr);
 
-	git_repository_free(repo);
+	suse_repo_close(sr);
 
 	git_libgit2_shutdown();
 
-	return error;
-
-error:
-	e = giterr_last();
-	cout << "Error: " << e->message << endl;
+	if (trace_close())
+		error = 1;
 
-	goto out;
+	return error;
 }
@@ -12,17 +12,32 @@
 
 #include <algorithm>
 #include <iostream>
+#include <thread>
+#include <atomic>
 #include <fstream>
 #include <string>
 #include <vector>
+#include <memory>
 #include <map>
 #include <set>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <errno.h>
+#include <poll.h>
 #include <git2.h>
 
+#include "output.h"
+#include "mem.h"
+#include "trace.h"
+#include "tune.h"
 #include "who.h"
 
 static std::string path_map_file;
@@ -30,6 +45,13 @@ static std::string db;
 static std::vector<std::string> ignore_params;
 static std::vector<std::string> params;
 static std::map<std::string, bool> ignore;
+static bool batch;
+static unsigned jobs;
+static const unsigned max_jobs = 256;
+static std::string serve_socket;
+static std::string trace_file;
+static bool mem_stats;
+static struct git_tuning tuning;
 
 std::string repo_path = ".";
 
@@ -47,7 +69,8 @@ static std::string trim(const std::string &line)
 	return line.substr(pos1, pos2-pos1+1);
 }
 
-static bool ignore_from_file(std::string filename)
+static bool ignore_from_file(std::string filename,
+			     std::map<std::string, bool> &ignore = ::ignore)
 {
 	std::ifstream file;
 	std::string line;
@@ -80,6 +103,17 @@ enum {
 	OPTION_REPO,
 	OPTION_IGNORE,
 	OPTION_DB,
+	OPTION_BATCH,
+	OPTION_JOBS,
+	OPTION_SERVE,
+	OPTION_TRACE,
+	OPTION_MEM_STATS,
+	OPTION_CACHE_SIZE,
+	OPTION_CACHE_LIMIT,
+	OPTION_MWINDOW_SIZE,
+	OPTION_MWINDOW_MAPPED_LIMIT,
+	OPTION_PREFETCH,
+	OPTION_NO_PREFETCH,
 };
 
 static struct option options[] = {
@@ -88,6 +122,17 @@ static struct option options[] = {
 	{ "repo",               required_argument,      0, OPTION_REPO           },
 	{ "ignore",             required_argument,      0, OPTION_IGNORE         },
 	{ "database",		required_argument,	0, OPTION_DB		 },
+	{ "batch",		no_argument,		0, OPTION_BATCH		 },
+	{ "jobs",		required_argument,	0, OPTION_JOBS		 },
+	{ "serve",		required_argument,	0, OPTION_SERVE		 },
+	{ "trace",		required_argument,	0, OPTION_TRACE		 },
+	{ "mem-stats",		no_argument,		0, OPTION_MEM_STATS	 },
+	{ "cache-size",		required_argument,	0, OPTION_CACHE_SIZE	 },
+	{ "cache-limit",	required_argument,	0, OPTION_CACHE_LIMIT	 },
+	{ "mwindow-size",	required_argument,	0, OPTION_MWINDOW_SIZE	 },
+	{ "mwindow-mapped-limit", required_argument,	0, OPTION_MWINDOW_MAPPED_LIMIT },
+	{ "prefetch",		no_argument,		0, OPTION_PREFETCH	 },
+	{ "no-prefetch",	no_argument,		0, OPTION_NO_PREFETCH	 },
 	{ 0,                    0,                      0, 0                     }
 };
 
@@ -103,6 +148,41 @@ static void usage(const char *prg)
 	std::cout << "                            are read from there" << std::endl;
 	std::cout << "  --database, -d <name>     Select database (set fixes.<name>.pathmap and " << std::endl;
 	std::cout << "                            fixes.<name>.ignore)" << std::endl;
+	std::cout << "  --batch                   Read commits from stdin, one per line, and print" << std::endl;
+	std::cout << "                            the developers for each of them. Lines from" << std::endl;
+	std::cout << "                            git-fixes --parsable are accepted too" << std::endl;
+	std::cout << "  --jobs, -j <num>          Number of threads used with --batch" << std::endl;
+	std::cout << "  --serve <socket>          Answer queries on a UNIX socket, for all" << std::endl;
+	std::cout << "                            databases set up in git-config" << std::endl;
+	std::cout << "  --trace <file>            Write a Chrome trace-event file of the run" << std::endl;
+	std::cout << "  --mem-stats               Print allocations and libgit2 cache size per" << std::endl;
+	std::cout << "                            phase, and the peak RSS reached up to each" << std::endl;
+	std::cout << "                            phase, to stderr" << std::endl;
+	std::cout << "  --cache-size <size>       Maximum size of the libgit2 object cache" << std::endl;
+	std::cout << "  --cache-limit <type=size> Largest commit, tree, blob or tag to cache" << std::endl;
+	std::cout << "  --mwindow-size <size>     Size of the windows packs are mapped with" << std::endl;
+	std::cout << "  --mwindow-mapped-limit <size>" << std::endl;
+	std::cout << "                            Maximum of pack data mapped at once" << std::endl;
+	std::cout << "  --prefetch                Read pack files ahead before the first query" << std::endl;
+	std::cout << "  --no-prefetch             Don't read pack files ahead" << std::endl;
+}
+
+static bool parse_jobs(const char *arg, unsigned &jobs)
+{
+	unsigned long val;
+	char *end;
+
+	if (*arg == '-')
+		return false;
+
+	errno = 0;
+	val = strtoul(arg, &end, 10);
+	if (errno || end == arg || *end || !val || val > max_jobs)
+		return false;
+
+	jobs = val;
+
+	return true;
 }
 
 static bool parse_options(int argc, char **argv)
@@ -112,7 +192,7 @@ static bool parse_options(int argc, char **argv)
 	while (true) {
 		int opt_idx;
 
-		c = getopt_long(argc, argv, "hp:r:i:d:", options, &opt_idx);
+		c = getopt_long(argc, argv, "hp:r:i:d:j:", options, &opt_idx);
 		if (c == -1)
 			break;
 
@@ -138,6 +218,55 @@ static bool parse_options(int argc, char **argv)
 		case 'd':
 			db = optarg;
 			break;
+		case OPTION_BATCH:
+			batch = true;
+			break;
+		case OPTION_JOBS:
+		case 'j':
+			if (!parse_jobs(optarg, jobs)) {
+				std::cerr << "Invalid number of jobs: " << optarg << std::endl;
+				return false;
+			}
+			break;
+		case OPTION_SERVE:
+			serve_socket = optarg;
+			break;
+		case OPTION_TRACE:
+			trace_file = optarg;
+			break;
+		case OPTION_MEM_STATS:
+			mem_stats = true;
+			break;
+		case OPTION_CACHE_SIZE:
+			if (tune_parse_size(optarg, tuning.cache_size)) {
+				std::cerr << "Invalid cache size: " << optarg << std::endl;
+				return false;
+			}
+			break;
+		case OPTION_CACHE_LIMIT:
+			if (tune_cache_limit(tuning, optarg)) {
+				std::cerr << "Invalid cache limit: " << optarg << std::endl;
+				return false;
+			}
+			break;
+		case OPTION_MWINDOW_SIZE:
+			if (tune_parse_size(optarg, tuning.mwindow_size)) {
+				std::cerr << "Invalid mwindow size: " << optarg << std::endl;
+				return false;
+			}
+			break;
+		case OPTION_MWINDOW_MAPPED_LIMIT:
+			if (tune_parse_size(optarg, tuning.mwindow_mapped_limit)) {
+				std::cerr << "Invalid mwindow mapped limit: " << optarg << std::endl;
+				return false;
+			}
+			break;
+		case OPTION_PREFETCH:
+			tuning.prefetch = 1;
+			break;
+		case OPTION_NO_PREFETCH:
+			tuning.prefetch = 0;
+			break;
 		default:
 			usage(argv[0]);
 			return false;
@@ -210,7 +339,9 @@ void load_git_config(git_repository *repo)
 	git_config_free(repo_cfg);
 }
 
-static void print_results(struct people &results)
+/* Drops ignored people, unless nobody else is in the list */
+static void apply_ignore(struct people &results,
+			 const std::map<std::string, bool> &ignore = ::ignore)
 {
 	bool do_ignore = false;
 
@@ -224,16 +355,565 @@ static void print_results(struct people &results)
 		}
 	}
 
+	if (!do_ignore)
+		return;
+
+	results.persons.erase(std::remove_if(results.persons.begin(),
+					     results.persons.end(),
+					     [&](const struct person &p) {
+						return ignore.find(p.name) != ignore.end();
+					     }),
+			      results.persons.end());
+}
+
+static void print_results(struct people &results)
+{
+	output_file out;
+
+	apply_ignore(results);
+
 	// Print results
-	for (auto &p : results.persons) {
-		if (do_ignore) {
-			auto pos = ignore.find(p.name);
-			if (pos != ignore.end())
+	out.open_stdout();
+
+	for (auto &p : results.persons)
+		out << p.name << " (" << p.count << ")\n";
+
+	out.commit();
+}
+
+struct batch_item {
+	std::string line;
+	std::string rev;
+	std::set<std::string> paths;
+	struct people results;
+	bool found;
+};
+
+/* Lines from git-fixes --parsable carry the commit-id in the second field */
+static std::string batch_revision(const std::string &line)
+{
+	size_t pos = line.find(';');
+
+	if (pos != std::string::npos)
+		return trim(line.substr(pos + 1, line.find(';', pos + 1) - pos - 1));
+
+	return line.substr(0, line.find_first_of(" \t"));
+}
+
+/*
+ * Reads commits from stdin and prints one line per commit with the
+ * input line and the developers separated by a tab. The changed paths
+ * are collected and matched by a pool of threads, each with its own
+ * repository handle.
+ */
+static int run_batch(git_who &who, git_repository *repo)
+{
+	std::vector<git_repository *> repos;
+	std::vector<struct batch_item> items;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> next(0);
+	mem_phase phase("batch");
+	std::string line;
+	output_file out;
+	int ret = 0;
+
+	while (getline(std::cin, line)) {
+		struct batch_item item;
+
+		item.line = trim(line);
+		if (item.line == "")
+			continue;
+
+		item.rev   = batch_revision(item.line);
+		item.found = false;
+		items.emplace_back(std::move(item));
+	}
+
+	if (!jobs)
+		jobs = 1;
+
+	// The default comes from the CPU count and was not checked
+	if (jobs > max_jobs)
+		jobs = max_jobs;
+
+	if (jobs > items.size())
+		jobs = items.size();
+
+	repos.push_back(repo);
+	for (unsigned w = 1; w < jobs; ++w) {
+		git_repository *r;
+
+		if (git_repository_open(&r, repo_path.c_str()) < 0)
+			break;
+
+		repos.push_back(r);
+	}
+
+	auto worker = [&](unsigned w) {
+		if (trace_enabled && w)
+			trace_thread_name("worker " + std::to_string(w));
+
+		while (true) {
+			size_t i = next++;
+
+			if (i >= items.size())
+				break;
+
+			if (trace_enabled)
+				trace_counter("queue depth", items.size() - i);
+
+			struct batch_item &item = items[i];
+
+			item.found = git_who::get_paths_from_revision(repos[w], item.rev,
+								      item.paths);
+			if (item.found)
+				who.match_paths(item.paths, item.results);
+		}
+	};
+
+	for (unsigned w = 1; w < repos.size(); ++w)
+		workers.emplace_back(worker, w);
+
+	worker(0);
+
+	for (auto &t : workers)
+		t.join();
+
+	for (unsigned w = 1; w < repos.size(); ++w)
+		git_repository_free(repos[w]);
+
+	out.open_stdout();
+
+	for (auto &item : items) {
+		if (!item.found) {
+			std::cerr << "Can't find commit: " << item.rev << std::endl;
+			ret = 1;
+		}
+
+		apply_ignore(item.results);
+
+		out << item.line << '\t';
+		for (size_t i = 0; i < item.results.persons.size(); ++i) {
+			const struct person &p = item.results.persons[i];
+
+			out << (i ? ", " : "") << p.name << " (" << p.count << ")";
+		}
+		out << '\n';
+	}
+
+	out.commit();
+
+	return ret;
+}
+
+/* Identifies a version of a file, to notice when it was replaced */
+struct file_stamp {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+
+	bool operator!=(const struct file_stamp &s) const
+	{
+		return dev != s.dev || ino != s.ino || size != s.size ||
+		       mtime.tv_sec != s.mtime.tv_sec ||
+		       mtime.tv_nsec != s.mtime.tv_nsec;
+	}
+};
+
+static struct file_stamp get_stamp(const std::string &filename)
+{
+	struct file_stamp stamp;
+	struct stat st;
+
+	memset(&stamp, 0, sizeof(stamp));
+	if (stat(filename.c_str(), &st))
+		return stamp;
+
+	stamp.dev   = st.st_dev;
+	stamp.ino   = st.st_ino;
+	stamp.size  = st.st_size;
+	stamp.mtime = st.st_mtim;
+
+	return stamp;
+}
+
+/* A path-map with its ignore-list, as served by --serve */
+struct database {
+	std::string path_map_file;
+	std::vector<std::string> ignore_params;
+
+	std::vector<struct file_stamp> stamps;
+	std::unique_ptr<git_who> who;
+	std::map<std::string, bool> ignore;
+};
+
+static std::vector<struct file_stamp> database_stamps(const struct database &d)
+{
+	std::vector<struct file_stamp> stamps;
+
+	stamps.push_back(get_stamp(d.path_map_file));
+	for (auto &i : d.ignore_params)
+		stamps.push_back(get_stamp(i));
+
+	return stamps;
+}
+
+/* (Re-)loads the files of a database when they changed on disk */
+static bool database_update(struct database &d)
+{
+	std::vector<struct file_stamp> stamps = database_stamps(d);
+	std::unique_ptr<git_who> who;
+	bool changed;
+
+	changed = !d.who || stamps.size() != d.stamps.size();
+	for (size_t i = 0; !changed && i < stamps.size(); ++i)
+		changed = (stamps[i] != d.stamps[i]);
+
+	if (!changed)
+		return true;
+
+	who.reset(new git_who);
+	if (who->load_path_map(d.path_map_file))
+		return false;
+
+	d.who    = std::move(who);
+	d.stamps = stamps;
+
+	d.ignore.clear();
+	for (auto &i : d.ignore_params) {
+		if (!ignore_from_file(i, d.ignore))
+			d.ignore[i] = true;
+	}
+
+	return true;
+}
+
+static int config_pathmap_cb(const git_config_entry *entry, void *data)
+{
+	auto dbs = static_cast<std::map<std::string, struct database> *>(data);
+	std::string name = entry->name;
+
+	// fixes.<name>.pathmap, the name may contain dots itself
+	name = name.substr(6, name.rfind('.') - 6);
+	(*dbs)[name];
+
+	return 0;
+}
+
+/*
+ * Collects all fixes.<name>.pathmap databases from git-config. A path-map
+ * given on the command line replaces the one of the default database.
+ */
+static void load_databases(git_repository *repo,
+			   std::map<std::string, struct database> &dbs)
+{
+	git_config *repo_cfg;
+
+	if (git_repository_config(&repo_cfg, repo) == 0) {
+		git_config_foreach_match(repo_cfg, "^fixes\\..+\\.pathmap$",
+					 config_pathmap_cb, &dbs);
+
+		for (auto &d : dbs) {
+			std::string key, val;
+
+			key = "fixes." + d.first + ".pathmap";
+			d.second.path_map_file = config_get_path_nofail(repo_cfg, key.c_str());
+
+			key = "fixes." + d.first + ".ignore";
+			val = config_get_path_nofail(repo_cfg, key.c_str());
+			if (val != "")
+				d.second.ignore_params.emplace_back(val);
+		}
+
+		git_config_free(repo_cfg);
+	}
+
+	if (path_map_file != "")
+		dbs[db].path_map_file = path_map_file;
+
+	for (auto &d : dbs) {
+		for (auto &i : ignore_params)
+			d.second.ignore_params.emplace_back(i);
+	}
+}
+
+static const size_t commit_cache_max = 1 << 16;
+
+/*
+ * Changed paths of the commits queried so far, keyed by commit-id. The
+ * cache is simply dropped when it grows too big.
+ */
+static std::map<std::string, std::set<std::string> > commit_cache;
+static unsigned long commit_cache_lookups, commit_cache_hits;
+
+static bool commit_paths(git_repository *repo, const std::string &rev,
+			 std::set<std::string> &paths)
+{
+	git_object *obj;
+	std::string id;
+
+	if (git_revparse_single(&obj, repo, rev.c_str()))
+		return false;
+
+	id = git_oid_tostr_s(git_object_id(obj));
+	git_object_free(obj);
+
+	auto it = commit_cache.find(id);
+
+	commit_cache_lookups += 1;
+	commit_cache_hits    += (it != commit_cache.end());
+
+	if (trace_enabled)
+		trace_counter("commit cache hit rate",
+			      100.0 * commit_cache_hits / commit_cache_lookups);
+
+	if (it == commit_cache.end()) {
+		std::set<std::string> commit;
+
+		if (!git_who::get_paths_from_revision(repo, id, commit))
+			return false;
+
+		if (commit_cache.size() >= commit_cache_max)
+			commit_cache.clear();
+
+		it = commit_cache.emplace(id, std::move(commit)).first;
+	}
+
+	paths.insert(it->second.begin(), it->second.end());
+
+	return true;
+}
+
+/*
+ * Answers one query line: an optional @<database> followed by the
+ * revisions and paths to match, like on the command line. The answer is
+ * the list of developers, terminated by an empty line.
+ */
+static std::string serve_query(git_repository *repo,
+			       std::map<std::string, struct database> &dbs,
+			       const std::string &line)
+{
+	std::set<std::string> paths;
+	struct people results;
+	std::string name, answer, word;
+	size_t pos = 0;
+
+	name = db;
+	if (name == "" && dbs.size() == 1)
+		name = dbs.begin()->first;
+
+	while (pos < line.length()) {
+		size_t end = line.find_first_of(" \t", pos);
+
+		if (end == std::string::npos)
+			end = line.length();
+
+		word = line.substr(pos, end - pos);
+		pos  = end + 1;
+
+		if (word == "")
+			continue;
+
+		if (word[0] == '@' && paths.empty()) {
+			name = word.substr(1);
+			continue;
+		}
+
+		if (!commit_paths(repo, word, paths))
+			// word is not a revision, treat as path
+			paths.insert(word);
+	}
+
+	auto d = dbs.find(name);
+	if (d == dbs.end())
+		return "error: unknown database '" + name + "'\n\n";
+
+	if (!database_update(d->second))
+		return "error: can't load path-map of '" + name + "'\n\n";
+
+	d->second.who->match_paths(paths, results);
+	apply_ignore(results, d->second.ignore);
+
+	for (auto &p : results.persons)
+		answer += p.name + " (" + std::to_string(p.count) + ")\n";
+
+	return answer + "\n";
+}
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig)
+{
+	serve_stop = 1;
+}
+
+/* Longest query line, clients sending longer ones are dropped */
+static const size_t serve_max_line = 1024 * 1024;
+
+/* Client sockets are non-blocking, replies wait in out until writable */
+struct serve_client {
+	std::string in;
+	std::string out;
+	bool eof;
+
+	serve_client() : eof(false) { }
+};
+
+/* Writes as much of the queued replies as the socket takes */
+static bool flush_client(int fd, struct serve_client &c)
+{
+	while (!c.out.empty()) {
+		ssize_t ret = write(fd, c.out.data(), c.out.length());
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		if (ret <= 0)
+			return false;
+
+		c.out.erase(0, ret);
+	}
+
+	return true;
+}
+
+/* Reads and answers queries, false when the client is to be dropped */
+static bool serve_client_input(git_repository *repo,
+			       std::map<std::string, struct database> &dbs,
+			       int fd, struct serve_client &c)
+{
+	char buf[4096];
+	ssize_t ret;
+	size_t pos;
+
+	ret = read(fd, buf, sizeof(buf));
+	if (ret < 0)
+		return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+
+	if (ret == 0)
+		c.eof = true;
+	else
+		c.in.append(buf, ret);
+
+	while ((pos = c.in.find('\n')) != std::string::npos) {
+		std::string line = trim(c.in.substr(0, pos));
+
+		c.in.erase(0, pos + 1);
+		c.out += serve_query(repo, dbs, line);
+	}
+
+	return c.in.length() <= serve_max_line;
+}
+
+/*
+ * Serves queries on a UNIX socket until SIGINT or SIGTERM. Clients send
+ * one query per line and may keep the connection open for more.
+ */
+static int run_server(git_repository *repo)
+{
+	std::map<std::string, struct database> dbs;
+	std::vector<struct serve_client> clients;
+	std::vector<struct pollfd> fds;
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	mem_phase phase("serve");
+	struct stat st;
+	int sock;
+
+	load_databases(repo, dbs);
+	if (dbs.empty()) {
+		std::cerr << "No path-map found, use -p or set fixes.<name>.pathmap" << std::endl;
+		return 1;
+	}
+
+	// Load everything upfront, so the first queries are fast too
+	for (auto &d : dbs) {
+		if (!database_update(d.second))
+			return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (serve_socket.length() >= sizeof(addr.sun_path)) {
+		std::cerr << "Socket path too long: " << serve_socket << std::endl;
+		return 1;
+	}
+	strcpy(addr.sun_path, serve_socket.c_str());
+
+	// Replace a stale socket from an earlier run, but nothing else
+	if (lstat(serve_socket.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(serve_socket.c_str());
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0 ||
+	    bind(sock, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(sock, 16)) {
+		std::cerr << "Can't listen on " << serve_socket << ": "
+			  << strerror(errno) << std::endl;
+		if (sock >= 0)
+			close(sock);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serve_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	fds.push_back({ sock, POLLIN, 0 });
+	clients.emplace_back();
+
+	while (!serve_stop) {
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR)
 				continue;
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept4(sock, NULL, NULL,
+					 SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+			if (fd >= 0) {
+				fds.push_back({ fd, POLLIN, 0 });
+				clients.emplace_back();
+			}
 		}
 
-		std::cout << p.name << " (" << p.count << ")" << std::endl;
+		for (size_t i = fds.size() - 1; i > 0; --i) {
+			struct serve_client &c = clients[i];
+			bool ok = true;
+
+			if (!fds[i].revents)
+				continue;
+
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				ok = serve_client_input(repo, dbs, fds[i].fd, c);
+
+			if (ok)
+				ok = flush_client(fds[i].fd, c);
+
+			// A client not reading its replies sends nothing more either
+			fds[i].events = c.out.empty() ? POLLIN : POLLOUT;
+
+			if (!ok || (c.eof && c.out.empty())) {
+				close(fds[i].fd);
+				fds.erase(fds.begin() + i);
+				clients.erase(clients.begin() + i);
+			}
+		}
 	}
+
+	for (size_t i = 1; i < fds.size(); ++i)
+		close(fds[i].fd);
+
+	close(sock);
+	unlink(serve_socket.c_str());
+
+	return 0;
 }
 
 int main(int argc, char **argv)
@@ -244,15 +924,39 @@ int main(int argc, char **argv)
 	git_who who;
 
 	ret = 1;
+	jobs = std::thread::hardware_concurrency();
 	if (!parse_options(argc, argv))
 		goto out;
 
+	if (trace_file != "" && trace_open(trace_file)) {
+		std::cerr << "Can't open trace file " << trace_file << std::endl;
+		goto out;
+	}
+
+	if ((batch || serve_socket != "") && !params.empty()) {
+		std::cerr << "--batch and --serve take no revisions or paths" << std::endl;
+		goto out;
+	}
+
+	mem_enabled = mem_stats;
+
 	git_libgit2_init();
 
 	error = git_repository_open(&repo, repo_path.c_str());
 	if (error < 0)
 		goto error;
 
+	tune_load_config(tuning, repo);
+	tune_apply(tuning);
+
+	if (tuning.prefetch > 0)
+		tune_prefetch(repo);
+
+	if (serve_socket != "") {
+		ret = run_server(repo);
+		goto out_repo;
+	}
+
 	if (db != "")
 		load_git_config(repo);
 
@@ -260,34 +964,48 @@ int main(int argc, char **argv)
 	if (ret)
 		goto out_repo;
 
-	for (auto &p : params) {
-		if (!who.get_paths_from_revision(repo, p))
-			// param is not a revision, treat as path
-			who.add_path(p);
-	}
-
 	for (auto &i : ignore_params) {
 		if (!ignore_from_file(i))
 			ignore[i] = true;
 	}
 
-	who.match_paths(results);
+	if (batch) {
+		ret = run_batch(who, repo);
+		goto out_repo;
+	}
+
+	{
+		mem_phase phase("match");
+
+		for (auto &p : params) {
+			if (!who.get_paths_from_revision(repo, p))
+				// param is not a revision, treat as path
+				who.add_path(p);
+		}
+
+		who.match_paths(results);
+	}
 
 	print_results(results);
 
 	ret = 0;
 
 out_repo:
+	mem_report(stderr);
+
 	git_repository_free(repo);
 
 out:
 	git_libgit2_shutdown();
 
+	if (trace_close())
+		ret = 1;
+
 	return ret;
 
 error:
 	auto e = giterr_last();
-	std::cerr << "Error: " << e->message << std::endl;
+	std::cerr << "Error: " << (e ? e->message : "Unknown libgit2 error") << std::endl;
 	ret = 1;
 
 	goto out;
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <algorithm>
+#include <vector>
+#include <mutex>
+
+#include <sys/resource.h>
+#include <string.h>
+#include <git2.h>
+
+#include "mem.h"
+
+using namespace std;
+
+bool mem_enabled;
+atomic<unsigned long> mem_allocs(0);
+atomic<unsigned long> mem_alloc_bytes(0);
+thread_local unsigned long mem_thread_allocs;
+
+struct mem_phase_stats {
+	const char *name;
+	unsigned long allocs;
+	unsigned long bytes;
+	long max_rss;		// KiB, process peak up to the end of the phase
+	long git_cache;		// KiB, at the end of the phase
+};
+
+static mutex mem_lock;
+static vector<struct mem_phase_stats> mem_phases;
+
+/* Peak RSS of the process since it started, in KiB */
+static long max_rss(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	return usage.ru_maxrss;
+}
+
+static void git_cache(long &current, long &allowed)
+{
+	ssize_t cur = 0, max = 0;
+
+	git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &cur, &max);
+
+	current = cur / 1024;
+	allowed = max / 1024;
+}
+
+void mem_read(struct mem_values &values)
+{
+	values.allocs = mem_allocs.load(memory_order_relaxed);
+	values.bytes  = mem_alloc_bytes.load(memory_order_relaxed);
+}
+
+void mem_add_phase(const char *name, const struct mem_values &start)
+{
+	struct mem_phase_stats *sum = NULL;
+	struct mem_values now;
+	long current, allowed;
+
+	mem_read(now);
+	git_cache(current, allowed);
+
+	lock_guard<mutex> guard(mem_lock);
+
+	for (auto &p : mem_phases) {
+		if (!strcmp(p.name, name)) {
+			sum = &p;
+			break;
+		}
+	}
+
+	if (!sum) {
+		mem_phases.push_back({ name, 0, 0, 0, 0 });
+		sum = &mem_phases.back();
+	}
+
+	sum->allocs   += now.allocs - start.allocs;
+	sum->bytes    += now.bytes - start.bytes;
+	sum->max_rss   = max(sum->max_rss, max_rss());
+	sum->git_cache = max(sum->git_cache, current);
+}
+
+void mem_report(FILE *out)
+{
+	long current, allowed;
+
+	if (!mem_enabled)
+		return;
+
+	git_cache(current, allowed);
+
+	fprintf(out, "%-16s %14s %14s %18s %14s\n", "Phase", "allocs",
+		"alloc-KiB", "max-RSS-so-far-KiB", "git-cache-KiB");
+
+	lock_guard<mutex> guard(mem_lock);
+
+	for (auto &p : mem_phases)
+		fprintf(out, "%-16s %14lu %14lu %18ld %14ld\n", p.name,
+			p.allocs, p.bytes / 1024, p.max_rss, p.git_cache);
+
+	fprintf(out, "Peak RSS: %ld KiB, libgit2 cache: %ld KiB (limit %ld KiB)\n",
+		max_rss(), current, allowed);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __MEM_H
+#define __MEM_H
+
+#include <atomic>
+
+#include <stdio.h>
+
+/*
+ * Memory accounting for --mem-stats. The tools count their own heap
+ * allocations in operator new (alloc.cc), the library only reads the
+ * counters. Every phase records the allocations made while it ran, the
+ * peak RSS the process reached so far and the size of the libgit2 object
+ * cache at its end. The kernel only keeps the peak since the start, so
+ * the RSS of a phase includes everything before it.
+ */
+
+extern bool mem_enabled;
+extern std::atomic<unsigned long> mem_allocs;
+extern std::atomic<unsigned long> mem_alloc_bytes;
+
+/* Allocations of the calling thread, not disturbed by other threads */
+extern thread_local unsigned long mem_thread_allocs;
+
+struct mem_values {
+	unsigned long allocs;
+	unsigned long bytes;
+};
+
+void mem_read(struct mem_values &values);
+void mem_add_phase(const char *name, const struct mem_values &start);
+void mem_report(FILE *out);
+
+/* Counts the enclosing scope as a phase, a NULL name disables it */
+class mem_phase {
+private:
+	const char *name;
+	struct mem_values start;
+
+public:
+	explicit mem_phase(const char *n)
+		: name(mem_enabled ? n : NULL)
+	{
+		if (name)
+			mem_read(start);
+	}
+
+	~mem_phase()
+	{
+		if (name)
+			mem_add_phase(name, start);
+	}
+
+	mem_phase(const mem_phase&) = delete;
+	mem_phase &operator=(const mem_phase&) = delete;
+};
+
+#endif /* __MEM_H */
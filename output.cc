@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <atomic>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "output.h"
+
+using namespace std;
+
+static const size_t buffer_size = 1 << 20;
+
+output_file::output_file()
+	: buffer(new char[buffer_size]), used(0), fd(-1), error(0)
+{
+}
+
+output_file::~output_file()
+{
+	discard();
+
+	delete[] buffer;
+}
+
+void output_file::write_fd(const char *data, size_t len)
+{
+	while (len && !error) {
+		ssize_t ret = ::write(fd, data, len);
+
+		if (ret < 0) {
+			if (errno != EINTR)
+				error = errno;
+			continue;
+		}
+
+		data += ret;
+		len  -= ret;
+	}
+}
+
+void output_file::flush(void)
+{
+	write_fd(buffer, used);
+	used = 0;
+}
+
+/*
+ * Creates a new file next to name. The kernel applies the umask, the
+ * process-wide umask() can't be read without changing it, which would
+ * race with files created by other threads.
+ */
+static int create_temp(string &tmp_name, const string &name)
+{
+	static atomic<unsigned> counter(0);
+
+	for (int i = 0; i < 100; ++i) {
+		char suffix[32];
+		int fd;
+
+		snprintf(suffix, sizeof(suffix), ".%d.%u", (int)getpid(), counter++);
+		tmp_name = name + suffix;
+
+		fd = ::open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+			    0666);
+		if (fd >= 0 || errno != EEXIST)
+			return fd;
+	}
+
+	return -1;
+}
+
+int output_file::open(const string &name, bool append)
+{
+	struct stat st;
+	bool exists;
+
+	discard();
+
+	filename = name;
+
+	// Appends go to the file itself, O_APPEND keeps concurrent writers intact
+	if (append) {
+		fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+			    0666);
+		return fd < 0 ? -1 : 0;
+	}
+
+	exists = (lstat(name.c_str(), &st) == 0);
+
+	// Symlinks, devices and pipes must not be replaced, write them directly
+	if (exists && !S_ISREG(st.st_mode)) {
+		fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			    0666);
+		return fd < 0 ? -1 : 0;
+	}
+
+	fd = create_temp(tmp_name, name);
+	if (fd < 0) {
+		tmp_name.clear();
+
+		// A writable file in a read-only directory is written in place
+		if (!exists || (errno != EACCES && errno != EROFS))
+			return -1;
+
+		fd = ::open(name.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+		return fd < 0 ? -1 : 0;
+	}
+
+	if (exists && fchmod(fd, st.st_mode & 07777)) {
+		int err = errno;
+
+		discard();
+		errno = err;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void output_file::open_stdout(void)
+{
+	discard();
+
+	filename = "<stdout>";
+	fd       = STDOUT_FILENO;
+}
+
+void output_file::write(const char *data, size_t len)
+{
+	if (fd < 0)
+		return;
+
+	if (used + len > buffer_size)
+		flush();
+
+	if (len >= buffer_size) {
+		write_fd(data, len);
+		return;
+	}
+
+	memcpy(buffer + used, data, len);
+	used += len;
+}
+
+/*
+ * Makes the written data visible. Regular files are synced and renamed
+ * over the destination. Returns 0 on success, -1 with errno set when
+ * anything failed, the destination is left untouched then.
+ */
+int output_file::commit(void)
+{
+	int err;
+
+	if (fd < 0)
+		return 0;
+
+	flush();
+
+	if (fd == STDOUT_FILENO) {
+		fd  = -1;
+		err = error;
+	} else if (tmp_name == "") {
+		if (::close(fd) && !error)
+			error = errno;
+
+		fd  = -1;
+		err = error;
+	} else {
+		if (!error && fsync(fd))
+			error = errno;
+
+		if (::close(fd) && !error)
+			error = errno;
+
+		fd = -1;
+
+		if (!error && rename(tmp_name.c_str(), filename.c_str()))
+			error = errno;
+
+		err = error;
+		if (err)
+			unlink(tmp_name.c_str());
+
+		tmp_name.clear();
+	}
+
+	error = 0;
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+void output_file::discard(void)
+{
+	if (fd >= 0 && fd != STDOUT_FILENO)
+		::close(fd);
+
+	if (tmp_name != "")
+		unlink(tmp_name.c_str());
+
+	tmp_name.clear();
+	fd    = -1;
+	used  = 0;
+	error = 0;
+}
+
+output_file &output_file::operator<<(const string &s)
+{
+	write(s.c_str(), s.length());
+
+	return *this;
+}
+
+output_file &output_file::operator<<(const char *s)
+{
+	write(s, strlen(s));
+
+	return *this;
+}
+
+output_file &output_file::operator<<(char c)
+{
+	write(&c, 1);
+
+	return *this;
+}
+
+output_file &output_file::operator<<(unsigned long n)
+{
+	char num[24];
+
+	write(num, snprintf(num, sizeof(num), "%lu", n));
+
+	return *this;
+}
+
+output_file &output_file::operator<<(unsigned n)
+{
+	return *this << (unsigned long)n;
+}
+
+output_file &output_file::operator<<(int n)
+{
+	char num[16];
+
+	write(num, snprintf(num, sizeof(num), "%d", n));
+
+	return *this;
+}
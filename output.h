@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+#include <string>
+
+/*
+ * Buffered output shared by all tools. Regular files are written to a
+ * temporary file in the same directory, which replaces the destination
+ * on commit() after it was synced to disk. Readers see either the old
+ * or the complete new file. Symlinks and special files like /dev/stdout
+ * are written in place, and so are existing files in directories where
+ * no temporary file can be created.
+ *
+ * In append mode the file itself is opened with O_APPEND, so that
+ * several writers don't lose each other's data.
+ *
+ * Data is only flushed in large chunks, so writing line by line is
+ * cheap. Without commit() the output is discarded, except for chunks
+ * append mode already flushed.
+ */
+class output_file {
+private:
+	std::string filename;
+	std::string tmp_name;
+	char *buffer;
+	size_t used;
+	int fd;
+	int error;
+
+	void flush(void);
+	void write_fd(const char*, size_t);
+
+public:
+	output_file();
+	~output_file();
+
+	int  open(const std::string&, bool append = false);
+	void open_stdout(void);
+	void write(const char*, size_t);
+	int  commit(void);
+	void discard(void);
+
+	output_file &operator<<(const std::string&);
+	output_file &operator<<(const char*);
+	output_file &operator<<(char);
+	output_file &operator<<(unsigned long);
+	output_file &operator<<(unsigned);
+	output_file &operator<<(int);
+};
+
+#endif /* __OUTPUT_H */
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2017 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __PATHMAP_H
+#define __PATHMAP_H
+
+#include <stdint.h>
+
+/*
+ * Binary path-map as written by git-suse --binary-path-map. The file is
+ * meant to be mapped into memory, so it is written in host byte order
+ * and all offsets are relative to the start of the file.
+ *
+ * The paths are stored as a trie of path components. Node 0 is the root,
+ * the children of a node are stored as a contiguous run of node indexes
+ * in the children table, sorted by name. Each node has a run of scores
+ * in the score table, which already include the scores of everything
+ * below the node. Component and developer names live in the string
+ * table; developer names are NUL-terminated and sorted, so developer ids
+ * compare like the names.
+ */
+
+#define PM_MAGIC	"GSPATHMP"
+#define PM_VERSION	1
+#define PM_BYTE_ORDER	0x01020304
+
+#define PM_NODE_KNOWN	1
+
+struct pm_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t nr_nodes;
+	uint32_t nr_children;
+	uint32_t nr_scores;
+	uint32_t nr_names;
+	uint64_t nodes_off;
+	uint64_t children_off;
+	uint64_t scores_off;
+	uint64_t names_off;
+	uint64_t strings_off;
+	uint64_t strings_size;
+};
+
+struct pm_node {
+	uint32_t name;		/* Offset in the string table */
+	uint32_t name_len;
+	uint32_t first_child;
+	uint32_t nr_children;
+	uint32_t first_score;
+	uint32_t nr_scores;
+	uint32_t flags;
+	uint32_t pad;
+};
+
+struct pm_score {
+	uint32_t id;
+	int32_t count;
+};
+
+#endif /* __PATHMAP_H */
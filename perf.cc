@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <utility>
+#include <vector>
+#include <mutex>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+using namespace std;
+
+bool perf_enabled;
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} perf_events[PERF_NR_COUNTERS] = {
+	{ "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES      },
+	{ "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS    },
+	{ "cache-misses",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES    },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES   },
+	{ "page-faults",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS     },
+};
+
+static int perf_fds[PERF_NR_COUNTERS] = { -1, -1, -1, -1, -1 };
+static mutex perf_lock;
+static vector<pair<const char *, struct perf_values> > perf_phases;
+
+int perf_open(void)
+{
+	int nr = 0, err = 0;
+
+	for (int i = 0; i < PERF_NR_COUNTERS; ++i) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size           = sizeof(attr);
+		attr.type           = perf_events[i].type;
+		attr.config         = perf_events[i].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+		attr.inherit        = 1;
+		attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				      PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		perf_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1,
+				      PERF_FLAG_FD_CLOEXEC);
+		if (perf_fds[i] < 0) {
+			err = err ? err : errno;
+			continue;
+		}
+
+		nr += 1;
+	}
+
+	if (!nr)
+		fprintf(stderr, "Performance counters not available: %s\n"
+			"Check /proc/sys/kernel/perf_event_paranoid\n",
+			strerror(err));
+
+	perf_enabled = (nr > 0);
+
+	return nr;
+}
+
+void perf_close(void)
+{
+	for (int i = 0; i < PERF_NR_COUNTERS; ++i) {
+		if (perf_fds[i] >= 0)
+			close(perf_fds[i]);
+		perf_fds[i] = -1;
+	}
+
+	perf_enabled = false;
+}
+
+/* Counters are scaled up when the kernel had to multiplex them */
+void perf_read(struct perf_values &values)
+{
+	for (int i = 0; i < PERF_NR_COUNTERS; ++i) {
+		uint64_t buf[3];
+
+		values.v[i] = 0;
+
+		if (perf_fds[i] < 0 ||
+		    read(perf_fds[i], buf, sizeof(buf)) != sizeof(buf) || !buf[2])
+			continue;
+
+		values.v[i] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+	}
+}
+
+void perf_add_phase(const char *name, const struct perf_values &start)
+{
+	struct perf_values now, *sum = NULL;
+
+	perf_read(now);
+
+	lock_guard<mutex> guard(perf_lock);
+
+	for (auto &p : perf_phases) {
+		if (!strcmp(p.first, name)) {
+			sum = &p.second;
+			break;
+		}
+	}
+
+	if (!sum) {
+		perf_phases.emplace_back(name, perf_values());
+		sum = &perf_phases.back().second;
+	}
+
+	for (int i = 0; i < PERF_NR_COUNTERS; ++i)
+		sum->v[i] += now.v[i] - start.v[i];
+}
+
+static void print_values(FILE *out, const char *name,
+			 const struct perf_values &values, unsigned long div)
+{
+	fprintf(out, "%-16s", name);
+
+	for (int i = 0; i < PERF_NR_COUNTERS; ++i) {
+		if (perf_fds[i] < 0)
+			fprintf(out, " %14s", "-");
+		else if (div == 1)
+			fprintf(out, " %14llu", (unsigned long long)values.v[i]);
+		else
+			fprintf(out, " %14.1f", (double)values.v[i] / div);
+	}
+
+	if (perf_fds[PERF_CYCLES] >= 0 && perf_fds[PERF_INSTRUCTIONS] >= 0 &&
+	    values.v[PERF_CYCLES])
+		fprintf(out, " %6.2f", (double)values.v[PERF_INSTRUCTIONS] /
+				       values.v[PERF_CYCLES]);
+	else
+		fprintf(out, " %6s", "-");
+
+	fprintf(out, "\n");
+}
+
+void perf_report(FILE *out, const char *walk_phase, unsigned long nr_commits)
+{
+	if (!perf_enabled)
+		return;
+
+	fprintf(out, "%-16s", "Phase");
+	for (int i = 0; i < PERF_NR_COUNTERS; ++i)
+		fprintf(out, " %14s", perf_events[i].name);
+	fprintf(out, " %6s\n", "IPC");
+
+	for (auto &p : perf_phases)
+		print_values(out, p.first, p.second, 1);
+
+	for (auto &p : perf_phases) {
+		if (!walk_phase || !nr_commits || strcmp(p.first, walk_phase))
+			continue;
+
+		print_values(out, "per commit", p.second, nr_commits);
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __PERF_H
+#define __PERF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Hardware performance counters for --perf-counters, read with
+ * perf_event_open() around the phases of a run. Only user-space is
+ * counted, including threads started after perf_open(). Counters the
+ * kernel or the machine does not provide are left out of the report.
+ *
+ * The counters are process-wide. Phases which overlap on different
+ * threads count each other's work, so parallel work is counted as one
+ * phase around all of it.
+ */
+
+enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_PAGE_FAULTS,
+	PERF_NR_COUNTERS,
+};
+
+struct perf_values {
+	uint64_t v[PERF_NR_COUNTERS];
+};
+
+extern bool perf_enabled;
+
+/* Returns the number of counters that could be opened */
+int  perf_open(void);
+void perf_close(void);
+void perf_read(struct perf_values &values);
+void perf_add_phase(const char *name, const struct perf_values &start);
+
+/*
+ * Prints the counters of every phase, and those of walk_phase also per
+ * commit scanned.
+ */
+void perf_report(FILE *out, const char *walk_phase, unsigned long nr_commits);
+
+/* Counts the enclosing scope as a phase, a NULL name disables it */
+class perf_phase {
+private:
+	const char *name;
+	struct perf_values start;
+
+public:
+	explicit perf_phase(const char *n)
+		: name(perf_enabled ? n : NULL)
+	{
+		if (name)
+			perf_read(start);
+	}
+
+	~perf_phase()
+	{
+		if (name)
+			perf_add_phase(name, start);
+	}
+
+	perf_phase(const perf_phase&) = delete;
+	perf_phase &operator=(const perf_phase&) = delete;
+};
+
+#endif /* __PERF_H */
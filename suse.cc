@@ -0,0 +1,1026 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <git2.h>
+
+#include "output.h"
+#include "mem.h"
+#include "trace.h"
+#include "suse.h"
+
+using namespace std;
+
+static const char *cache_magic    = "# git-suse patch-cache v2";
+static const char *cache_magic_v1 = "# git-suse patch-cache v1";
+static const long cache_max_age   = 30;		// Days
+
+/* Returns the end of the line starting at p, without the newline */
+static const char *line_end(const char *p, const char *end)
+{
+	const char *nl = (const char *)memchr(p, '\n', end - p);
+
+	return nl ? nl : end;
+}
+
+static bool is_tag(const char *s, size_t len, const char *tag)
+{
+	return strlen(tag) == len && !strncasecmp(s, tag, len);
+}
+
+static const char *domains[] = {
+	"suse.de",
+	"suse.cz",
+	"suse.com",
+	"novell.com",
+	0,
+};
+
+static bool is_suse_email(const char *email, size_t len)
+{
+	const char *at = (const char *)memchr(email, '@', len);
+	const char *domain;
+	size_t dlen;
+
+	if (!at)
+		return false;
+
+	domain = at + 1;
+	dlen   = email + len - domain;
+
+	for (const char **c = domains; *c; ++c) {
+		if (is_tag(domain, dlen, *c))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Resolves paths in a tree without walking all of it. Trees of the
+ * directories looked at are kept, so that the patches of a series only
+ * cost a lookup by name in their directory.
+ */
+struct tree_lookup {
+	git_repository *repo;
+	git_tree *root;
+	map<string, git_tree *> dirs;
+
+	tree_lookup(git_repository *r, git_tree *t) : repo(r), root(t) { }
+
+	~tree_lookup()
+	{
+		for (auto &d : dirs)
+			git_tree_free(d.second);
+	}
+};
+
+static git_tree *lookup_dir(struct tree_lookup &tl, const string &dir)
+{
+	const git_tree_entry *entry;
+	git_tree *parent, *tree;
+	string name;
+
+	if (dir == "")
+		return tl.root;
+
+	auto it = tl.dirs.find(dir);
+	if (it != tl.dirs.end())
+		return it->second;
+
+	auto pos = dir.find_last_of("/");
+	if (pos == string::npos) {
+		parent = tl.root;
+		name   = dir;
+	} else {
+		parent = lookup_dir(tl, dir.substr(0, pos));
+		name   = dir.substr(pos + 1);
+	}
+
+	tree = NULL;
+	if (parent) {
+		entry = git_tree_entry_byname(parent, name.c_str());
+		if (entry && git_tree_entry_type(entry) == GIT_OBJ_TREE &&
+		    git_tree_lookup(&tree, tl.repo, git_tree_entry_id(entry)))
+			tree = NULL;
+	}
+
+	tl.dirs[dir] = tree;
+
+	return tree;
+}
+
+static const git_oid *lookup_path(struct tree_lookup &tl, struct branch &b,
+				  const string &path)
+{
+	const git_tree_entry *entry;
+	git_tree *tree;
+	string name;
+
+	auto oid_it = b.file_oid_map.find(path);
+	if (oid_it != b.file_oid_map.end())
+		return &oid_it->second;
+
+	auto pos = path.find_last_of("/");
+	if (pos == string::npos) {
+		tree = tl.root;
+		name = path;
+	} else {
+		tree = lookup_dir(tl, path.substr(0, pos));
+		name = path.substr(pos + 1);
+	}
+
+	if (!tree)
+		return NULL;
+
+	entry = git_tree_entry_byname(tree, name.c_str());
+	if (!entry || git_tree_entry_type(entry) != GIT_OBJ_BLOB)
+		return NULL;
+
+	return &(b.file_oid_map[path] = *git_tree_entry_id(entry));
+}
+
+static int blob_content(git_blob **blob, const string &path,
+			struct tree_lookup &tl, struct branch &b)
+{
+	const git_oid *oid;
+
+	oid = lookup_path(tl, b, path);
+	if (!oid) {
+		giterr_set_str(GIT_ENOTFOUND, "Path not found");
+		return GIT_ENOTFOUND;
+	}
+
+	return git_blob_lookup(blob, tl.repo, oid);
+}
+
+/* Blob data is not NUL-terminated, it is always scanned with its size */
+static const char *blob_begin(const git_blob *blob)
+{
+	return (const char *)git_blob_rawcontent(blob);
+}
+
+static const char *blob_end(const git_blob *blob)
+{
+	return blob_begin(blob) + git_blob_rawsize(blob);
+}
+
+static void parse_commit_id(const char *p, const char *eol,
+			    vector<string> &ids)
+{
+	const char *id;
+
+	while (p < eol && *p == ' ')
+		++p;
+
+	for (id = p; p < eol && isxdigit(*p); ++p)
+		;
+
+	if (p - id != 40)
+		return;
+
+	ids.emplace_back(id, 40);
+	transform(ids.back().begin(), ids.back().end(), ids.back().begin(),
+		  ::tolower);
+}
+
+/* The last SUSE address on the line becomes the committer of the patch */
+static void parse_emails(const char *p, const char *eol,
+			 struct patch_data &patch)
+{
+	while (p < eol) {
+		const char *s, *e;
+
+		while (p < eol && (*p == ' ' || *p == '\t'))
+			++p;
+
+		for (s = p; p < eol && *p != ' ' && *p != '\t'; ++p)
+			;
+
+		e = p;
+		while (s < e && (*s == '\r' || *s == '\n'))
+			++s;
+		while (e > s && (e[-1] == '\r' || e[-1] == '\n'))
+			--e;
+
+		if (s == e || !memchr(s, '@', e - s))
+			continue;
+
+		if (*s == '<')
+			++s;
+
+		if (s == e)
+			continue;
+
+		if (e[-1] == '>')
+			--e;
+
+		if (is_suse_email(s, e - s))
+			patch.committer.assign(s, e - s);
+	}
+}
+
+/*
+ * Collects the paths of all "+++ " lines of the diff, p points to the
+ * newline of the "---" line. Only the markers are looked at, the lines
+ * between them are skipped by memmem().
+ */
+static void parse_diff_paths(const char *p, const char *end,
+			     struct patch_data &patch)
+{
+	while (p < end) {
+		const char *path, *eol, *c;
+
+		p = (const char *)memmem(p, end - p, "\n+++ ", 5);
+		if (!p)
+			break;
+
+		path = p + 5;
+		eol  = line_end(path, end);
+		p    = eol;
+
+		if (path == eol)
+			continue;
+
+		c = (const char *)memchr(path, '/', eol - path);
+		if (c)
+			path = c + 1;
+
+		c = (const char *)memchr(path, ' ', eol - path);
+
+		patch.paths.emplace_back(path, (c ? c : eol) - path);
+	}
+}
+
+static void parse_patch(const git_oid *oid, git_repository *repo,
+			struct patch_data &patch, bool need_paths)
+{
+	const char *p, *end, *eol;
+	git_blob *blob;
+
+	patch.committer = "Unknown";
+	patch.has_paths = need_paths;
+
+	if (git_blob_lookup(&blob, repo, oid))
+		return;
+
+	end = blob_end(blob);
+
+	for (p = blob_begin(blob); p < end; p = eol + 1) {
+		const char *colon;
+		size_t len;
+
+		eol = line_end(p, end);
+
+		if (eol - p == 3 && !memcmp(p, "---", 3)) {
+			if (need_paths)
+				parse_diff_paths(eol, end, patch);
+			break;
+		}
+
+		colon = (const char *)memchr(p, ':', eol - p);
+		if (!colon || colon + 1 >= eol)
+			continue;
+
+		len = colon - p;
+
+		if (is_tag(p, len, "git-commit") || is_tag(p, len, "alt-commit"))
+			parse_commit_id(colon + 1, eol, patch.commit_ids);
+		else if (is_tag(p, len, "no-fix"))
+			parse_commit_id(colon + 1, eol, patch.blacklist);
+		else if (is_tag(p, len, "signed-off-by") ||
+			 is_tag(p, len, "acked-by") ||
+			 is_tag(p, len, "reviewed-by"))
+			parse_emails(p, eol, patch);
+	}
+
+	git_blob_free(blob);
+}
+
+static unsigned intern_committer(struct path_trie &trie, const string &name)
+{
+	auto it = trie.committer_ids.find(name);
+
+	if (it != trie.committer_ids.end())
+		return it->second;
+
+	trie.committers.push_back(name);
+
+	return trie.committer_ids[name] = trie.committers.size() - 1;
+}
+
+void add_count(vector<struct path_count> &counts, unsigned committer,
+	       unsigned count)
+{
+	for (auto &c : counts) {
+		if (c.committer == committer) {
+			c.count += count;
+			return;
+		}
+	}
+
+	counts.push_back({ committer, count });
+}
+
+static unsigned trie_child(struct path_trie &trie, unsigned node,
+			   const char *name, size_t len)
+{
+	auto &children = trie.nodes[node].children;
+	unsigned idx;
+
+	auto it = lower_bound(children.begin(), children.end(), make_pair(name, len),
+			      [](const pair<string, unsigned> &c,
+				 const pair<const char *, size_t> &n) {
+				return c.first.compare(0, string::npos,
+						       n.first, n.second) < 0;
+			      });
+
+	if (it != children.end() &&
+	    !it->first.compare(0, string::npos, name, len))
+		return it->second;
+
+	idx = trie.nodes.size();
+	children.insert(it, make_pair(string(name, len), idx));
+	trie.nodes.emplace_back(node, name, len);
+
+	return idx;
+}
+
+/* Every path, including the empty one, has at least one component */
+static void count_paths(struct path_trie &trie, const struct patch_data &patch,
+			unsigned committer)
+{
+	for (auto &path : patch.paths) {
+		const char *p   = path.c_str();
+		const char *end = p + path.length();
+		unsigned node   = 0;
+
+		while (true) {
+			const char *c = (const char *)memchr(p, '/', end - p);
+			const char *e = c ? c : end;
+
+			node = trie_child(trie, node, p, e - p);
+			if (!c)
+				break;
+
+			p = c + 1;
+		}
+
+		add_count(trie.nodes[node].counts, committer, 1);
+	}
+}
+
+static void merge_trie(struct path_trie &dst, unsigned dnode,
+		       const struct path_trie &src, unsigned snode)
+{
+	for (auto &c : src.nodes[snode].counts)
+		add_count(dst.nodes[dnode].counts, c.committer, c.count);
+
+	for (auto &child : src.nodes[snode].children) {
+		unsigned idx = trie_child(dst, dnode, child.first.c_str(),
+					  child.first.length());
+
+		merge_trie(dst, idx, src, child.second);
+	}
+}
+
+static void merge_patch(const string &path, const struct patch_data &patch,
+			results_type &results, set<string> &blacklist)
+{
+	string committer = patch.committer;
+
+	auto pos = path.find_first_of("/");
+	if (pos != std::string::npos) {
+		auto directory = path.substr(0, pos);
+
+		// Count patches in "patches.kernel.org" directory
+		// as Base fixes
+		if (directory == "patches.kernel.org")
+			committer = "Base";
+
+	}
+
+	for (auto &id : patch.blacklist)
+		blacklist.emplace(id);
+
+	for (auto &it : patch.commit_ids) {
+		results[it].context = committer;
+		results[it].path = path;
+	}
+}
+
+static void parse_blacklist(const git_blob *blob,
+			    set<string> &blacklist,
+			    vector<string> &path_blacklist)
+{
+	const char *p, *end, *eol;
+
+	end = blob_end(blob);
+
+	for (p = blob_begin(blob); p < end; p = eol + 1) {
+		const char *e;
+
+		eol = line_end(p, end);
+
+		while (p < eol && strchr(" \t\r", *p))
+			++p;
+
+		for (e = p; e < eol && !strchr("# \t\r", *e); ++e)
+			;
+
+		if (e - p == 40 && all_of(p, e, ::isxdigit)) {
+			string id(p, e);
+
+			transform(id.begin(), id.end(), id.begin(), ::tolower);
+			blacklist.emplace(id);
+		} else if (e > p) {
+			path_blacklist.emplace_back(p, e);
+		}
+	}
+}
+
+static void mkdir_p(const string &dir)
+{
+	size_t pos = 0;
+
+	while (pos != string::npos) {
+		pos = dir.find_first_of('/', pos + 1);
+		mkdir(dir.substr(0, pos).c_str(), 0755);
+	}
+}
+
+string suse_default_cache_file(void)
+{
+	const char *dir;
+
+	dir = getenv("XDG_CACHE_HOME");
+	if (dir && *dir)
+		return string(dir) + "/git-suse/patches";
+
+	dir = getenv("HOME");
+	if (!dir || !*dir)
+		return "";
+
+	return string(dir) + "/.cache/git-suse/patches";
+}
+
+static void split_words(vector<string> &items, const string &s)
+{
+	size_t pos = 0;
+
+	while (pos < s.length()) {
+		size_t end = s.find_first_of(' ', pos);
+
+		if (end == string::npos)
+			end = s.length();
+
+		if (end > pos)
+			items.emplace_back(s.substr(pos, end - pos));
+
+		pos = end + 1;
+	}
+}
+
+static string join_words(const vector<string> &items)
+{
+	string ret;
+
+	for (auto &i : items) {
+		if (ret.length())
+			ret += ' ';
+		ret += i;
+	}
+
+	return ret;
+}
+
+/*
+ * One line per blob with tab separated fields:
+ * blob-id, day of the last use, committer, p or - for whether paths were
+ * collected, commit ids, No-fix ids and touched paths. The lists are
+ * separated by spaces. Version 1 lacks the day, its entries count as used
+ * today.
+ */
+void suse_load_cache(struct patch_cache &cache)
+{
+	trace_span span("load_cache");
+	mem_phase phase("load_cache");
+	unsigned nr_fields;
+	ifstream file;
+	string line;
+
+	cache.today = time(NULL) / 86400;
+
+	if (!cache.enabled)
+		return;
+
+	file.open(cache.filename.c_str());
+	if (!file.is_open())
+		return;
+
+	if (!getline(file, line))
+		return;
+
+	if (line == cache_magic)
+		nr_fields = 7;
+	else if (line == cache_magic_v1)
+		nr_fields = 6;
+	else
+		return;
+
+	while (getline(file, line)) {
+		struct patch_data patch;
+		vector<string> fields;
+		size_t pos = 0;
+		long day;
+
+		while (fields.size() < nr_fields) {
+			size_t end = line.find_first_of('\t', pos);
+
+			if (end == string::npos)
+				end = line.length();
+
+			fields.emplace_back(line.substr(pos, end - pos));
+
+			if (end == line.length())
+				break;
+
+			pos = end + 1;
+		}
+
+		if (fields.size() != nr_fields || fields[0].length() != 40)
+			continue;
+
+		if (nr_fields == 7) {
+			day = strtol(fields[1].c_str(), NULL, 10);
+			fields.erase(fields.begin() + 1);
+		} else {
+			day = cache.today;
+		}
+
+		patch.committer = fields[1];
+		patch.has_paths = (fields[2] == "p");
+		split_words(patch.commit_ids, fields[3]);
+		split_words(patch.blacklist, fields[4]);
+		split_words(patch.paths, fields[5]);
+
+		cache.entries[fields[0]]   = patch;
+		cache.last_used[fields[0]] = day;
+	}
+}
+
+void suse_save_cache(struct patch_cache &cache)
+{
+	trace_span span("save_cache");
+	mem_phase phase("save_cache");
+	output_file file;
+
+	if (!cache.enabled || !cache.dirty)
+		return;
+
+	auto pos = cache.filename.find_last_of("/");
+	if (pos != string::npos)
+		mkdir_p(cache.filename.substr(0, pos));
+
+	if (file.open(cache.filename)) {
+		fprintf(stderr, "Can't write patch cache %s\n", cache.filename.c_str());
+		return;
+	}
+
+	file << cache_magic << '\n';
+
+	for (auto &e : cache.entries) {
+		const struct patch_data &patch = e.second;
+		long day = cache.last_used[e.first];
+
+		// Patches of branches nobody looks at anymore
+		if (cache.today - day > cache_max_age)
+			continue;
+
+		file << e.first << '\t' << (unsigned long)day << '\t'
+		     << patch.committer << '\t'
+		     << (patch.has_paths ? "p" : "-") << '\t'
+		     << join_words(patch.commit_ids) << '\t'
+		     << join_words(patch.blacklist) << '\t'
+		     << join_words(patch.paths) << '\n';
+	}
+
+	if (file.commit())
+		fprintf(stderr, "Can't write patch cache %s\n", cache.filename.c_str());
+}
+
+static const struct patch_data *cache_lookup(const struct suse_repo &sr,
+					     const git_oid *oid)
+{
+	auto it = sr.cache.entries.find(git_oid_tostr_s(oid));
+
+	if (it == sr.cache.entries.end())
+		return NULL;
+
+	// Cached without paths, but the path-map needs them
+	if (sr.need_paths && !it->second.has_paths)
+		return NULL;
+
+	return &it->second;
+}
+
+/*
+ * Calls fn(idx, worker) for every idx in [0, nr) on up to nr_threads
+ * threads. worker is the number of the thread doing the call, so that
+ * callers can hand out per-thread resources.
+ */
+static void run_parallel(size_t nr, size_t nr_threads,
+			 const function<void(size_t, unsigned)> &fn)
+{
+	vector<thread> workers;
+	atomic<size_t> next(0);
+
+	auto worker = [&](unsigned w) {
+		if (trace_enabled && w)
+			trace_thread_name("worker " + to_string(w));
+
+		while (true) {
+			size_t i = next++;
+
+			if (i >= nr)
+				break;
+
+			if (trace_enabled)
+				trace_counter("queue depth", nr - i);
+
+			fn(i, w);
+		}
+	};
+
+	if (nr_threads > nr)
+		nr_threads = nr;
+
+	for (unsigned w = 1; w < nr_threads; ++w)
+		workers.emplace_back(worker, w);
+
+	worker(0);
+
+	for (auto &t : workers)
+		t.join();
+}
+
+/* The first word containing a '/' on each line names a patch */
+static void parse_series(const git_blob *blob, vector<string> &series_patches)
+{
+	trace_span span("parse_series");
+	const char *p, *end, *eol;
+
+	end = blob_end(blob);
+
+	for (p = blob_begin(blob); p < end; p = eol + 1) {
+		const char *stop;
+
+		eol  = line_end(p, end);
+		stop = (const char *)memchr(p, '#', eol - p);
+		if (!stop)
+			stop = eol;
+
+		while (p < stop) {
+			const char *s, *e;
+
+			while (p < stop && (*p == ' ' || *p == '\t'))
+				++p;
+
+			for (s = p; p < stop && *p != ' ' && *p != '\t'; ++p)
+				;
+
+			e = p;
+			while (s < e && *s == '\r')
+				++s;
+			while (e > s && e[-1] == '\r')
+				--e;
+
+			if (memchr(s, '/', e - s)) {
+				series_patches.emplace_back(s, e);
+				break;
+			}
+		}
+	}
+}
+
+static const struct patch_data missing_patch;
+
+/*
+ * A patch in the series of a --base branch is unchanged when the base
+ * has the same blob in its series. All its commits are in the base then
+ * and can't be part of the result.
+ */
+static bool unchanged_patch(const struct branch &b, const set<string> &parent_series,
+			    const string &path, const git_oid *oid)
+{
+	if (!b.parent || parent_series.find(path) == parent_series.end())
+		return false;
+
+	auto it = b.parent->file_oid_map.find(path);
+
+	return it != b.parent->file_oid_map.end() && git_oid_equal(&it->second, oid);
+}
+
+/*
+ * Reads blacklist.conf and series.conf of the branch and looks up the
+ * blobs of all patches in the series. Patches found in the cache are
+ * resolved right away, the others are left for parse_patches().
+ */
+static int load_branch(const struct suse_repo &sr, git_repository *repo,
+		       struct branch &b)
+{
+	trace_span span("load_branch");
+	set<string> parent_series;
+	git_commit *commit;
+	git_object *obj;
+	git_tree *tree;
+	git_blob *blob;
+	int error;
+
+	error = git_revparse_single(&obj, repo, b.revision.c_str());
+	if (error < 0)
+		goto out;
+
+	error = git_commit_lookup(&commit, repo, git_object_id(obj));
+	if (error)
+		goto out_obj_free;
+
+	error = git_commit_tree(&tree, commit);
+	if (error)
+		goto out_commit_free;
+
+	{
+		struct tree_lookup tl(repo, tree);
+
+		b.file_oid_map.clear();
+
+		error = blob_content(&blob, "blacklist.conf", tl, b);
+		if (!error) {
+			parse_blacklist(blob, b.blacklist, b.path_blacklist);
+			git_blob_free(blob);
+		}
+
+		error = blob_content(&blob, "series.conf", tl, b);
+		if (error)
+			goto out_free_tree;
+
+		parse_series(blob, b.series_patches);
+		git_blob_free(blob);
+
+		b.oids.resize(b.series_patches.size());
+		b.data.resize(b.series_patches.size());
+
+		// Unchanged patches only matter when all branch data is needed
+		if (b.parent && !b.need_all)
+			parent_series.insert(b.parent->series_patches.begin(),
+					     b.parent->series_patches.end());
+
+		// Patches not in the tree are ignored, cached ones need no parsing
+		for (size_t i = 0; i < b.series_patches.size(); ++i) {
+			const string &path = b.series_patches[i];
+			const git_oid *oid = lookup_path(tl, b, path);
+
+			if (!oid || unchanged_patch(b, parent_series, path, oid)) {
+				b.data[i] = &missing_patch;
+				continue;
+			}
+
+			b.oids[i] = *oid;
+			b.data[i] = cache_lookup(sr, &b.oids[i]);
+		}
+	}
+
+out_free_tree:
+	git_tree_free(tree);
+
+out_commit_free:
+	git_commit_free(commit);
+
+out_obj_free:
+	git_object_free(obj);
+
+out:
+	if (error) {
+		const git_error *e = giterr_last();
+
+		b.error     = error;
+		b.error_msg = e ? e->message : "Unknown error";
+	}
+
+	return error;
+}
+
+/*
+ * Parses all patch blobs referenced by the branches which are not in the
+ * cache yet. Blobs shared between branches are parsed only once.
+ */
+static void parse_patches(struct suse_repo &sr, vector<struct branch *> &branches)
+{
+	struct patch_cache &cache = sr.cache;
+	vector<struct patch_data> parsed;
+	map<string, size_t> job_idx;
+	vector<git_oid> job_oids;
+	vector<string> job_keys;
+
+	for (auto b : branches) {
+		for (size_t i = 0; i < b->data.size(); ++i) {
+			if (b->data[i])
+				continue;
+
+			string key = git_oid_tostr_s(&b->oids[i]);
+
+			if (job_idx.find(key) != job_idx.end())
+				continue;
+
+			job_idx[key] = job_oids.size();
+			job_oids.push_back(b->oids[i]);
+			job_keys.push_back(key);
+		}
+	}
+
+	parsed.resize(job_oids.size());
+
+	if (trace_enabled) {
+		size_t hits = 0, misses = 0;
+
+		for (auto b : branches) {
+			for (auto d : b->data) {
+				hits   += (d && d != &missing_patch);
+				misses += !d;
+			}
+		}
+
+		trace_counter("patch cache hit rate",
+			      hits + misses ? 100.0 * hits / (hits + misses) : 100.0);
+	}
+
+	run_parallel(job_oids.size(), sr.repos.size(),
+		     [&](size_t i, unsigned w) {
+			trace_span span("parse_patch");
+
+			parse_patch(&job_oids[i], sr.repos[w], parsed[i],
+				    sr.need_paths);
+		     });
+
+	for (size_t i = 0; i < parsed.size(); ++i) {
+		swap(cache.entries[job_keys[i]], parsed[i]);
+		cache.dirty = true;
+	}
+
+	for (auto b : branches) {
+		for (size_t i = 0; i < b->data.size(); ++i) {
+			if (b->data[i] == &missing_patch)
+				continue;
+
+			string key = git_oid_tostr_s(&b->oids[i]);
+
+			if (!b->data[i])
+				b->data[i] = &cache.entries[key];
+
+			// The cache is rewritten at most once a day for this
+			long &day = cache.last_used[key];
+			if (day != cache.today) {
+				day = cache.today;
+				cache.dirty = true;
+			}
+		}
+	}
+}
+
+/*
+ * Builds the results of a branch from its parsed patches. The path-map
+ * is counted on nr_threads threads with per-thread maps.
+ */
+static void merge_branch(struct branch &b, size_t nr_threads)
+{
+	trace_span span("merge_branch");
+	// Merge in series order, so that later patches win
+	for (size_t i = 0; i < b.series_patches.size(); ++i)
+		merge_patch(b.series_patches[i], *b.data[i], b.results,
+			    b.blacklist);
+
+	if (!b.need_path_map)
+		return;
+
+	// Committer ids are shared by all per-thread tries
+	vector<unsigned> committers(b.data.size());
+	for (size_t i = 0; i < b.data.size(); ++i)
+		committers[i] = intern_committer(b.path_map, b.data[i]->committer);
+
+	vector<struct path_trie> tries(max<size_t>(nr_threads, 1) - 1);
+
+	run_parallel(b.data.size(), nr_threads,
+		     [&](size_t i, unsigned w) {
+			count_paths(w ? tries[w - 1] : b.path_map, *b.data[i],
+				    committers[i]);
+		     });
+
+	for (auto &trie : tries)
+		merge_trie(b.path_map, 0, trie, 0);
+}
+
+int suse_repo_open(struct suse_repo &sr, const string &path, unsigned jobs)
+{
+	int error = 0;
+
+	jobs = min(max(jobs, 1U), (unsigned)SUSE_MAX_JOBS);
+
+	// Every worker thread needs its own repository handle
+	while (sr.repos.size() < jobs) {
+		git_repository *repo;
+
+		error = git_repository_open(&repo, path.c_str());
+		if (error < 0)
+			break;
+
+		sr.repos.push_back(repo);
+	}
+
+	return sr.repos.empty() ? error : 0;
+}
+
+void suse_repo_close(struct suse_repo &sr)
+{
+	for (auto repo : sr.repos)
+		git_repository_free(repo);
+
+	sr.repos.clear();
+}
+
+int suse_load(struct suse_repo &sr, vector<struct branch *> &branches,
+	      struct branch *base, string &error_msg)
+{
+	vector<struct branch *> all = branches;
+	size_t threads_per_branch;
+	struct mem_values start;
+
+	mem_read(start);
+
+	// Branches in --base mode are loaded relative to the base
+	if (base && load_branch(sr, sr.repos[0], *base)) {
+		error_msg = base->error_msg;
+		return base->error;
+	}
+
+	run_parallel(branches.size(), sr.repos.size(),
+		     [&](size_t i, unsigned w) {
+			load_branch(sr, sr.repos[w], *branches[i]);
+		     });
+
+	if (mem_enabled)
+		mem_add_phase("load_branches", start);
+
+	for (auto b : branches) {
+		if (b->error) {
+			error_msg = b->error_msg;
+			return b->error;
+		}
+	}
+
+	if (base)
+		all.push_back(base);
+
+	mem_read(start);
+	parse_patches(sr, all);
+
+	if (mem_enabled)
+		mem_add_phase("parse_patches", start);
+
+	threads_per_branch = max<size_t>(sr.repos.size() / all.size(), 1);
+
+	// This builds the path-maps too
+	mem_read(start);
+	run_parallel(all.size(), sr.repos.size(),
+		     [&](size_t i, unsigned w) {
+			merge_branch(*all[i], threads_per_branch);
+		     });
+
+	if (mem_enabled)
+		mem_add_phase("merge_branches", start);
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __SUSE_H
+#define __SUSE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include <git2.h>
+
+/*
+ * Reading the commit-list, blacklist and path-map out of kernel-source
+ * revisions. Used by git-suse to write them to files and by git-fixes
+ * to load them directly into the engine.
+ */
+
+struct patch_info {
+	std::string context;
+	std::string path;
+};
+
+using results_type = std::map<std::string, struct patch_info>;
+
+/*
+ * The path-map is counted in a trie of path components. Each node only
+ * holds the counts of patches touching exactly its path, the counts of
+ * directories are rolled up when the map is written. Committers are
+ * interned, so a count is just a pair of small integers.
+ */
+struct path_count {
+	unsigned committer;
+	unsigned count;
+};
+
+struct path_node {
+	unsigned parent;
+	std::string name;
+	std::vector<std::pair<std::string, unsigned> > children;	// Sorted by name
+	std::vector<struct path_count> counts;
+
+	path_node(unsigned p, const char *n, size_t len)
+		: parent(p), name(n, len) { }
+};
+
+struct path_trie {
+	std::vector<struct path_node> nodes;			// nodes[0] is the root
+	std::vector<std::string> committers;
+	std::map<std::string, unsigned> committer_ids;
+
+	path_trie() { nodes.emplace_back(0, "", 0); }
+};
+
+/* Everything parse_patch() extracts from a single patch file */
+struct patch_data {
+	std::vector<std::string> commit_ids;
+	std::vector<std::string> blacklist;
+	std::vector<std::string> paths;
+	std::string committer;
+	bool has_paths;
+
+	patch_data() : has_paths(false) { }
+};
+
+/*
+ * Parse results of patch blobs, keyed by the blob id. Blobs never change,
+ * so the cache is kept on disk and shared between runs and branches.
+ * Entries no run used for a month are dropped when the cache is saved.
+ */
+struct patch_cache {
+	std::map<std::string, struct patch_data> entries;
+	std::map<std::string, long> last_used;	// Days since the epoch
+	std::string filename;
+	long today;
+	bool enabled;
+	bool dirty;
+
+	patch_cache() : today(0), enabled(true), dirty(false) { }
+};
+
+/* State of one kernel-source revision */
+struct branch {
+	std::string revision;
+
+	/* The base of the branch in --base mode */
+	const struct branch *parent;
+
+	/* Also load patches that are unchanged from the parent */
+	bool need_all;
+
+	/* Count the path-map of the branch */
+	bool need_path_map;
+
+	/* Blob ids of the files looked up in the tree of the branch */
+	std::map<std::string, git_oid> file_oid_map;
+
+	std::vector<std::string> series_patches;
+	std::vector<git_oid> oids;
+	std::vector<const struct patch_data *> data;
+
+	results_type results;
+	std::set<std::string> blacklist;
+	std::vector<std::string> path_blacklist;
+	struct path_trie path_map;
+
+	int error;
+	std::string error_msg;
+
+	branch() : parent(NULL), need_all(false), need_path_map(false), error(0) { }
+};
+
+/* A kernel-source repository opened once per worker thread */
+struct suse_repo {
+	std::vector<git_repository *> repos;
+	struct patch_cache cache;
+
+	/* Set when any path-map is counted and patch bodies need parsing */
+	bool need_paths;
+
+	suse_repo() : need_paths(false) { }
+};
+
+/* Upper bound for worker threads, each of them holds an open repository */
+#define SUSE_MAX_JOBS	256
+
+int  suse_repo_open(struct suse_repo &sr, const std::string &path, unsigned jobs);
+void suse_repo_close(struct suse_repo &sr);
+
+std::string suse_default_cache_file(void);
+void suse_load_cache(struct patch_cache &cache);
+void suse_save_cache(struct patch_cache &cache);
+
+/*
+ * Loads the given branches and, when not NULL, the base they refer to
+ * as parent. On failure the message of the first failing branch is
+ * returned in error_msg.
+ */
+int suse_load(struct suse_repo &sr, std::vector<struct branch *> &branches,
+	      struct branch *base, std::string &error_msg);
+
+void add_count(std::vector<struct path_count> &counts, unsigned committer,
+	       unsigned count);
+
+#endif /* __SUSE_H */
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "trace.h"
+
+using namespace std;
+
+bool trace_enabled;
+
+struct trace_event {
+	const char *name;
+	char ph;		// 'X' for spans, 'C' for counters
+	uint64_t ts;
+	uint64_t dur;
+	double value;
+};
+
+struct trace_buffer {
+	unsigned tid;
+	string name;
+	vector<struct trace_event> events;
+};
+
+static mutex trace_lock;
+static vector<unique_ptr<struct trace_buffer> > trace_buffers;
+static string trace_file;
+static chrono::steady_clock::time_point trace_origin;
+static unsigned trace_generation;
+
+static thread_local struct trace_buffer *thread_buffer;
+static thread_local unsigned thread_generation;
+
+/* Buffers are only shared when a thread emits its first event */
+static struct trace_buffer *get_buffer(void)
+{
+	if (thread_buffer && thread_generation == trace_generation)
+		return thread_buffer;
+
+	lock_guard<mutex> guard(trace_lock);
+
+	trace_buffers.emplace_back(new trace_buffer);
+	thread_buffer      = trace_buffers.back().get();
+	thread_generation  = trace_generation;
+	thread_buffer->tid = trace_buffers.size();
+	thread_buffer->events.reserve(1024);
+
+	return thread_buffer;
+}
+
+int trace_open(const string &filename)
+{
+	output_file file;
+
+	// Fail early, not after the run
+	if (file.open(filename))
+		return -1;
+
+	file.discard();
+
+	trace_file         = filename;
+	trace_origin       = chrono::steady_clock::now();
+	trace_generation  += 1;
+	trace_enabled      = true;
+
+	trace_thread_name("main");
+
+	return 0;
+}
+
+uint64_t trace_now(void)
+{
+	auto d = chrono::steady_clock::now() - trace_origin;
+
+	return chrono::duration_cast<chrono::nanoseconds>(d).count();
+}
+
+void trace_complete(const char *name, uint64_t start)
+{
+	uint64_t now = trace_now();
+
+	get_buffer()->events.push_back({ name, 'X', start, now - start, 0 });
+}
+
+void trace_counter(const char *name, double value)
+{
+	if (!trace_enabled)
+		return;
+
+	get_buffer()->events.push_back({ name, 'C', trace_now(), 0, value });
+}
+
+void trace_thread_name(const string &name)
+{
+	if (!trace_enabled)
+		return;
+
+	get_buffer()->name = name;
+}
+
+static string json_string(const string &s)
+{
+	string ret = "\"";
+
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if ((unsigned char)c < 0x20) {
+			char esc[8];
+
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			ret += esc;
+		} else {
+			ret += c;
+		}
+	}
+
+	return ret + "\"";
+}
+
+/* Trace-event timestamps are in microseconds */
+static const char *usecs(uint64_t ns)
+{
+	static char buf[32];
+
+	snprintf(buf, sizeof(buf), "%llu.%03llu",
+		 (unsigned long long)(ns / 1000),
+		 (unsigned long long)(ns % 1000));
+
+	return buf;
+}
+
+/* Writes the trace file, all threads must be done with their events */
+int trace_close(void)
+{
+	const char *sep = "\n";
+	output_file file;
+	int ret = 0;
+	int pid;
+
+	if (!trace_enabled)
+		return 0;
+
+	trace_enabled = false;
+	pid = getpid();
+
+	if (file.open(trace_file)) {
+		ret = -1;
+		goto out;
+	}
+
+	file << "{\"traceEvents\":[";
+
+	for (auto &b : trace_buffers) {
+		if (b->name != "") {
+			file << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+			     << ",\"tid\":" << b->tid << ",\"args\":{\"name\":"
+			     << json_string(b->name) << "}}";
+			sep = ",\n";
+		}
+
+		for (auto &e : b->events) {
+			file << sep << "{\"name\":" << json_string(e.name)
+			     << ",\"ph\":\"" << e.ph << "\",\"pid\":" << pid
+			     << ",\"tid\":" << b->tid << ",\"ts\":" << usecs(e.ts);
+
+			if (e.ph == 'X') {
+				file << ",\"dur\":" << usecs(e.dur) << "}";
+			} else {
+				char value[32];
+
+				snprintf(value, sizeof(value), "%g", e.value);
+				file << ",\"args\":{\"value\":" << value << "}}";
+			}
+
+			sep = ",\n";
+		}
+	}
+
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+	ret = file.commit();
+
+out:
+	if (ret)
+		fprintf(stderr, "Can't write trace file %s: %s\n",
+			trace_file.c_str(), strerror(errno));
+
+	trace_buffers.clear();
+
+	return ret;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <string>
+
+#include <stdint.h>
+
+/*
+ * Trace-event output for --trace, in the JSON format understood by
+ * chrome://tracing and Perfetto. Events are collected in per-thread
+ * buffers and written by trace_close(). Every thread gets its own track.
+ *
+ * When tracing is off, a span costs one test of trace_enabled.
+ */
+
+extern bool trace_enabled;
+
+int  trace_open(const std::string &filename);
+int  trace_close(void);
+
+uint64_t trace_now(void);
+void trace_complete(const char *name, uint64_t start);
+void trace_counter(const char *name, double value);
+void trace_thread_name(const std::string &name);
+
+/* Times the enclosing scope, a NULL name disables the span */
+class trace_span {
+private:
+	const char *name;
+	uint64_t start;
+
+public:
+	explicit trace_span(const char *n)
+		: name(trace_enabled ? n : NULL), start(0)
+	{
+		if (name)
+			start = trace_now();
+	}
+
+	~trace_span()
+	{
+		if (name)
+			trace_complete(name, start);
+	}
+
+	trace_span(const trace_span&) = delete;
+	trace_span &operator=(const trace_span&) = delete;
+};
+
+#endif /* __TRACE_H */
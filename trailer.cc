@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2016-2018 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <string.h>
+#include <ctype.h>
+
+#include "trailer.h"
+
+using namespace std;
+
+static const char *kind_names[TRAILER_NR_KINDS] = {
+	"fixes", "revert", "cherry-pick", "upstream", "stable",
+};
+
+static const char *default_trailers[] = {
+	"fixes=Fixes:",
+	"revert=This reverts commit %H.",
+	"cherry-pick=(cherry picked from commit %H)",
+	"upstream=commit %H upstream.",
+	"upstream=[ Upstream commit %H ]",
+	"upstream=Upstream commit %H",
+	"stable=stable@kernel.org",
+	"stable=stable@vger.kernel.org",
+};
+
+static string to_lower(string s)
+{
+	transform(s.begin(), s.end(), s.begin(), ::tolower);
+
+	return s;
+}
+
+static string trim(const string &s)
+{
+	size_t pos1 = s.find_first_not_of(" \t");
+	size_t pos2 = s.find_last_not_of(" \t");
+
+	if (pos1 == string::npos)
+		return "";
+
+	return s.substr(pos1, pos2 - pos1 + 1);
+}
+
+int trailer_parse(const string &spec, struct trailer &t)
+{
+	size_t eq = spec.find('=');
+	string pattern = spec;
+	size_t id;
+
+	t.kind = TRAILER_FIXES;
+
+	// Without a known kind in front the whole spec is the pattern
+	for (int i = 0; eq != string::npos && i < TRAILER_NR_KINDS; ++i) {
+		if (spec.compare(0, eq, kind_names[i]))
+			continue;
+
+		t.kind  = (enum trailer_kind)i;
+		pattern = spec.substr(eq + 1);
+		break;
+	}
+
+	pattern = to_lower(trim(pattern));
+
+	id = pattern.find("%h");
+
+	t.has_id   = (id != string::npos);
+	t.prefix   = pattern.substr(0, id);
+	t.suffix   = t.has_id ? pattern.substr(id + 2) : "";
+	t.anchored = (t.kind != TRAILER_STABLE);
+
+	if (t.prefix == "" || (t.kind == TRAILER_STABLE && t.has_id))
+		return -1;
+
+	return 0;
+}
+
+void trailer_defaults(vector<struct trailer> &trailers)
+{
+	for (auto spec : default_trailers) {
+		struct trailer t;
+
+		trailer_parse(spec, t);
+		trailers.push_back(t);
+	}
+}
+
+trailer_matcher::trailer_matcher()
+	: nr_classes(1)
+{
+	memset(classes, 0, sizeof(classes));
+	next.assign(1, 0);
+	out_begin.assign(2, 0);
+}
+
+int trailer_matcher::compile(const vector<struct trailer> &t)
+{
+	vector<vector<uint16_t> > out;
+	vector<uint16_t> fail, queue;
+	vector<int> child;
+	unsigned nr_states = 1;
+
+	memset(classes, 0, sizeof(classes));
+	nr_classes = 1;
+
+	// Characters not in any prefix share class 0
+	for (auto &tr : t) {
+		for (unsigned char c : tr.prefix) {
+			if (classes[c])
+				continue;
+
+			if (nr_classes == 256)
+				return -1;
+
+			classes[c] = nr_classes;
+			classes[toupper(c)] = nr_classes;
+			nr_classes += 1;
+		}
+	}
+
+	// Build the trie, -1 marks a missing child
+	child.assign(nr_classes, -1);
+	out.resize(1);
+
+	for (size_t i = 0; i < t.size(); ++i) {
+		unsigned state = 0;
+
+		for (unsigned char c : t[i].prefix) {
+			int &n = child[state * nr_classes + classes[c]];
+
+			if (n < 0) {
+				if (nr_states == 0xffff)
+					return -1;
+
+				n = nr_states++;
+				child.resize(nr_states * nr_classes, -1);
+				out.resize(nr_states);
+			}
+
+			state = child[state * nr_classes + classes[c]];
+		}
+
+		out[state].push_back(i);
+	}
+
+	// Breadth first, so that the fail state is complete before its use
+	next.assign(nr_states * nr_classes, 0);
+	fail.assign(nr_states, 0);
+
+	for (unsigned c = 0; c < nr_classes; ++c) {
+		int n = child[c];
+
+		if (n > 0) {
+			next[c] = n;
+			queue.push_back(n);
+		}
+	}
+
+	for (size_t q = 0; q < queue.size(); ++q) {
+		unsigned state = queue[q];
+
+		out[state].insert(out[state].end(), out[fail[state]].begin(),
+				  out[fail[state]].end());
+
+		for (unsigned c = 0; c < nr_classes; ++c) {
+			int n = child[state * nr_classes + c];
+			unsigned f = next[fail[state] * nr_classes + c];
+
+			if (n < 0) {
+				next[state * nr_classes + c] = f;
+				continue;
+			}
+
+			next[state * nr_classes + c] = n;
+			fail[n] = f;
+			queue.push_back(n);
+		}
+	}
+
+	out_begin.assign(nr_states + 1, 0);
+	out_list.clear();
+
+	for (unsigned s = 0; s < nr_states; ++s) {
+		out_begin[s] = out_list.size();
+		out_list.insert(out_list.end(), out[s].begin(), out[s].end());
+	}
+	out_begin[nr_states] = out_list.size();
+
+	trailers = t;
+
+	return 0;
+}
+
+unsigned trailer_matcher::match(const char *line, size_t len,
+				struct trailer_hit *hits, unsigned max) const
+{
+	unsigned state = 0, nr = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		state = next[state * nr_classes + classes[(unsigned char)line[i]]];
+
+		if (out_begin[state] == out_begin[state + 1])
+			continue;
+
+		for (uint32_t k = out_begin[state]; k < out_begin[state + 1]; ++k) {
+			const struct trailer &t = trailers[out_list[k]];
+
+			if (t.anchored && i + 1 != t.prefix.size())
+				continue;
+
+			if (nr < max)
+				hits[nr++] = { out_list[k], i + 1 };
+		}
+	}
+
+	return nr;
+}
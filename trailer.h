@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016-2018 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __TRAILER_H
+#define __TRAILER_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+/*
+ * Lines of a commit message that reference other commits. A trailer is
+ * given as "[<kind>=]<pattern>", where a %H in the pattern stands for the
+ * commit-id and the text after it has to end the line. Without a %H all
+ * commit-ids on the line are taken. Kinds are "fixes" (the default),
+ * "revert", "cherry-pick", "upstream" and "stable". Stable trailers have no
+ * commit-id and may appear anywhere in a line, all others have to start
+ * it. Patterns are matched without regard to case.
+ */
+
+enum trailer_kind {
+	TRAILER_FIXES,
+	TRAILER_REVERT,
+	TRAILER_CHERRY_PICK,
+	TRAILER_UPSTREAM,
+	TRAILER_STABLE,
+	TRAILER_NR_KINDS,
+};
+
+struct trailer {
+	enum trailer_kind kind;
+	std::string prefix;	// Lower case text in front of the commit-id
+	std::string suffix;	// Lower case text after the commit-id
+	bool has_id;
+	bool anchored;
+};
+
+struct trailer_hit {
+	unsigned idx;		// Index of the trailer
+	size_t end;		// Offset behind the prefix in the line
+};
+
+int  trailer_parse(const std::string &spec, struct trailer &t);
+void trailer_defaults(std::vector<struct trailer> &trailers);
+
+/*
+ * All trailer prefixes compiled into one Aho-Corasick automaton with full
+ * transitions over byte classes. Scanning a line costs one table lookup
+ * per character, no matter how many trailers there are.
+ */
+class trailer_matcher {
+private:
+	std::vector<struct trailer> trailers;
+	uint8_t classes[256];
+	unsigned nr_classes;
+	std::vector<uint16_t> next;
+	std::vector<uint32_t> out_begin;
+	std::vector<uint16_t> out_list;
+
+public:
+	trailer_matcher();
+
+	/* Returns -1 when the automaton would get too big */
+	int compile(const std::vector<struct trailer> &t);
+
+	const struct trailer &get(unsigned idx) const
+	{
+		return trailers[idx];
+	}
+
+	unsigned match(const char *line, size_t len,
+		       struct trailer_hit *hits, unsigned max) const;
+};
+
+#endif /* __TRAILER_H */
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mem.h"
+#include "trace.h"
+#include "tune.h"
+
+using namespace std;
+
+static const struct {
+	const char *name;
+	const char *config;
+	int type;
+} tune_types[TUNE_NR_TYPES] = {
+	{ "commit", "fixes.cache-limit-commit", GIT_OBJ_COMMIT },
+	{ "tree",   "fixes.cache-limit-tree",   GIT_OBJ_TREE   },
+	{ "blob",   "fixes.cache-limit-blob",   GIT_OBJ_BLOB   },
+	{ "tag",    "fixes.cache-limit-tag",    GIT_OBJ_TAG    },
+};
+
+int tune_parse_size(const char *arg, int64_t &size)
+{
+	unsigned shift = 0;
+	char *end;
+
+	errno = 0;
+	size  = strtoll(arg, &end, 10);
+	if (end == arg || size < 0 || errno == ERANGE)
+		return -1;
+
+	switch (*end) {
+	case 'k':
+	case 'K':
+		shift = 10;
+		end  += 1;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		end  += 1;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		end  += 1;
+		break;
+	}
+
+	// The size with its suffix must still fit into an int64_t
+	if (*end || size > (INT64_MAX >> shift))
+		return -1;
+
+	size <<= shift;
+
+	return 0;
+}
+
+int tune_cache_limit(struct git_tuning &t, const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+
+	if (!eq)
+		return -1;
+
+	for (int i = 0; i < TUNE_NR_TYPES; ++i) {
+		if (strlen(tune_types[i].name) != (size_t)(eq - arg) ||
+		    strncmp(tune_types[i].name, arg, eq - arg))
+			continue;
+
+		return tune_parse_size(eq + 1, t.cache_limit[i]);
+	}
+
+	return -1;
+}
+
+static void config_size(git_config *cfg, const char *name, int64_t &size)
+{
+	int64_t val;
+
+	// The command line wins
+	if (size >= 0)
+		return;
+
+	if (git_config_get_int64(&val, cfg, name))
+		return;
+
+	if (val < 0) {
+		fprintf(stderr, "Ignoring negative %s\n", name);
+		return;
+	}
+
+	size = val;
+}
+
+void tune_load_config(struct git_tuning &t, git_repository *repo)
+{
+	git_config *cfg;
+	int val;
+
+	if (git_repository_config(&cfg, repo))
+		return;
+
+	config_size(cfg, "fixes.cache-size", t.cache_size);
+
+	for (int i = 0; i < TUNE_NR_TYPES; ++i)
+		config_size(cfg, tune_types[i].config, t.cache_limit[i]);
+
+	config_size(cfg, "fixes.mwindow-size", t.mwindow_size);
+	config_size(cfg, "fixes.mwindow-mapped-limit", t.mwindow_mapped_limit);
+
+	if (t.prefetch < 0 && !git_config_get_bool(&val, cfg, "fixes.prefetch"))
+		t.prefetch = val ? 1 : 0;
+
+	git_config_free(cfg);
+}
+
+void tune_apply(const struct git_tuning &t)
+{
+	if (t.cache_size >= 0)
+		git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)t.cache_size);
+
+	for (int i = 0; i < TUNE_NR_TYPES; ++i) {
+		if (t.cache_limit[i] >= 0)
+			git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT,
+					 tune_types[i].type, (size_t)t.cache_limit[i]);
+	}
+
+	if (t.mwindow_size > 0)
+		git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, (size_t)t.mwindow_size);
+
+	if (t.mwindow_mapped_limit > 0)
+		git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT,
+				 (size_t)t.mwindow_mapped_limit);
+}
+
+static bool has_suffix(const char *name, const char *suffix)
+{
+	size_t len = strlen(name), slen = strlen(suffix);
+
+	return len > slen && !strcmp(name + len - slen, suffix);
+}
+
+static void prefetch_packs(const string &objects)
+{
+	string dir = objects + "/pack";
+	struct dirent *e;
+	DIR *d;
+
+	d = opendir(dir.c_str());
+	if (!d)
+		return;
+
+	while ((e = readdir(d)) != NULL) {
+		string path;
+		int fd;
+
+		if (!has_suffix(e->d_name, ".idx") && !has_suffix(e->d_name, ".pack"))
+			continue;
+
+		path = dir + "/" + e->d_name;
+
+		fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+		close(fd);
+	}
+
+	closedir(d);
+}
+
+void tune_prefetch(git_repository *repo)
+{
+	trace_span span("prefetch");
+	mem_phase phase("prefetch");
+	vector<string> dirs;
+	ifstream alternates;
+	string objects, line;
+
+#if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR < 26
+	objects = string(git_repository_path(repo)) + "objects";
+#else
+	objects = string(git_repository_commondir(repo)) + "objects";
+#endif
+
+	dirs.push_back(objects);
+
+	// Alternates are absolute or relative to the objects directory
+	alternates.open(objects + "/info/alternates");
+	while (getline(alternates, line)) {
+		if (line == "" || line[0] == '#')
+			continue;
+
+		dirs.push_back(line[0] == '/' ? line : objects + "/" + line);
+	}
+
+	for (auto &dir : dirs)
+		prefetch_packs(dir);
+}
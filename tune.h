@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __TUNE_H
+#define __TUNE_H
+
+#include <stdint.h>
+#include <git2.h>
+
+/*
+ * Tuning of the libgit2 object cache and pack mmap windows. Values are
+ * taken from the command line first, then from the fixes.* settings in
+ * git-config. Anything left unset keeps the libgit2 default.
+ */
+
+enum {
+	TUNE_COMMIT,
+	TUNE_TREE,
+	TUNE_BLOB,
+	TUNE_TAG,
+	TUNE_NR_TYPES,
+};
+
+struct git_tuning {
+	int64_t cache_size;
+	int64_t cache_limit[TUNE_NR_TYPES];
+	int64_t mwindow_size;
+	int64_t mwindow_mapped_limit;
+	int prefetch;
+
+	git_tuning()
+		: cache_size(-1), mwindow_size(-1), mwindow_mapped_limit(-1),
+		  prefetch(-1)
+	{
+		for (int i = 0; i < TUNE_NR_TYPES; ++i)
+			cache_limit[i] = -1;
+	}
+};
+
+/* Sizes take a k, m or g suffix like in git-config */
+int  tune_parse_size(const char *arg, int64_t &size);
+
+/* Parses <type>=<size> for --cache-limit */
+int  tune_cache_limit(struct git_tuning &t, const char *arg);
+
+void tune_load_config(struct git_tuning &t, git_repository *repo);
+
+/* Must run before the first pack is opened to affect the windows */
+void tune_apply(const struct git_tuning &t);
+
+/*
+ * Asks the kernel to read the pack and index files of the repository and
+ * its alternates ahead, so that the walk does not fault them in page by
+ * page.
+ */
+void tune_prefetch(git_repository *repo);
+
+#endif /* __TUNE_H */
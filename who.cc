@@ -16,15 +16,191 @@
 #include <string>
 #include <vector>
 #include <map>
-
+#include <unordered_map>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <git2.h>
 
+#include "trace.h"
+#include "mem.h"
 #include "who.h"
 
+static const char *path_map_compact_magic = "# git-suse path-map compact v1";
+
+static void add_score(std::vector<struct pm_score> &scores, unsigned id, int count)
+{
+	for (auto &s : scores) {
+		if (s.id == id) {
+			s.count += count;
+			return;
+		}
+	}
+
+	scores.push_back({ id, count });
+}
+
+unsigned git_who::intern(const std::string &name)
+{
+	auto it = name_ids.find(name);
+
+	if (it != name_ids.end())
+		return it->second;
+
+	names.push_back(name);
+
+	return name_ids[name] = names.size() - 1;
+}
+
+git_who::~git_who()
+{
+	if (map)
+		munmap(const_cast<char *>(map), map_size);
+}
+
+static bool section_ok(uint64_t off, uint64_t nr, size_t size, size_t map_size)
+{
+	return !(off % 8) && off <= map_size && nr <= (map_size - off) / size;
+}
+
+/*
+ * Maps a binary path-map into memory. Only the header and the section
+ * sizes are checked here, everything else is checked when it is read.
+ * No pointer into the map is derived before its section was checked.
+ */
+int git_who::map_binary(int fd, size_t size)
+{
+	const struct pm_header *hdr;
+	const char *strings;
+	void *addr;
+
+	if (size < sizeof(*hdr))
+		return -1;
+
+	addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED)
+		return -1;
+
+	hdr = static_cast<const struct pm_header *>(addr);
+
+	if (memcmp(hdr->magic, PM_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != PM_VERSION ||
+	    hdr->byte_order != PM_BYTE_ORDER ||
+	    !hdr->nr_nodes ||
+	    !section_ok(hdr->nodes_off, hdr->nr_nodes, sizeof(struct pm_node), size) ||
+	    !section_ok(hdr->children_off, hdr->nr_children, sizeof(uint32_t), size) ||
+	    !section_ok(hdr->scores_off, hdr->nr_scores, sizeof(struct pm_score), size) ||
+	    !section_ok(hdr->names_off, hdr->nr_names, sizeof(uint32_t), size) ||
+	    !section_ok(hdr->strings_off, hdr->strings_size, 1, size) ||
+	    !hdr->strings_size)
+		goto out_unmap;
+
+	strings = static_cast<const char *>(addr) + hdr->strings_off;
+	if (strings[hdr->strings_size - 1])
+		goto out_unmap;
+
+	map      = static_cast<const char *>(addr);
+	map_size = size;
+	pm       = hdr;
+
+	return 0;
+
+out_unmap:
+	munmap(addr, size);
+
+	return -1;
+}
+
+static inline const struct pm_node *pm_node(const char *map,
+					    const struct pm_header *pm,
+					    unsigned idx)
+{
+	return reinterpret_cast<const struct pm_node *>(map + pm->nodes_off) + idx;
+}
+
+bool git_who::known(unsigned node)
+{
+	if (!pm)
+		return path_map[node].known;
+
+	return pm_node(map, pm, node)->flags & PM_NODE_KNOWN;
+}
+
+const struct pm_score *git_who::scores(unsigned node, unsigned &nr)
+{
+	const struct pm_node *n;
+
+	if (!pm) {
+		nr = path_map[node].scores.size();
+		return path_map[node].scores.data();
+	}
+
+	n  = pm_node(map, pm, node);
+	nr = 0;
+	if ((uint64_t)n->first_score + n->nr_scores > pm->nr_scores)
+		return NULL;
+
+	nr = n->nr_scores;
+
+	return reinterpret_cast<const struct pm_score *>(map + pm->scores_off) +
+	       n->first_score;
+}
+
+const char *git_who::name(unsigned id)
+{
+	uint32_t off;
+
+	if (!pm)
+		return names[id].c_str();
+
+	off = reinterpret_cast<const uint32_t *>(map + pm->names_off)[id];
+
+	// The string table is NUL-terminated, checked in map_binary()
+	return off < pm->strings_size ? map + pm->strings_off + off : "";
+}
+
+unsigned git_who::nr_names(void)
+{
+	return pm ? pm->nr_names : names.size();
+}
+
 int git_who::load_path_map(std::string filename)
 {
+	trace_span span("load_path_map");
+	mem_phase phase("load_path_map");
+	std::vector<struct pm_score> scores;
+	char magic[sizeof(pm->magic)];
 	std::ifstream file;
 	std::string line;
+	struct stat st;
+	path_walk walk;
+	bool compact;
+	int fd;
+
+	fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "Can't open path-map file: " << filename << std::endl;
+		return 1;
+	}
+
+	// Binary path-maps are not parsed, but mapped into memory
+	if (fstat(fd, &st) == 0 &&
+	    pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+	    !memcmp(magic, PM_MAGIC, sizeof(magic))) {
+		int ret = map_binary(fd, st.st_size);
+
+		close(fd);
+		if (ret)
+			std::cerr << "Invalid binary path-map file: " << filename << std::endl;
+
+		return ret ? 1 : 0;
+	}
+
+	close(fd);
 
 	file.open(filename.c_str());
 	if (!file.is_open()) {
@@ -32,44 +208,53 @@ int git_who::load_path_map(std::string filename)
 		return 1;
 	}
 
+	// Compact path-maps only carry the counts of the touched paths
+	std::getline(file, line);
+	compact = (line == path_map_compact_magic);
+	if (!compact) {
+		file.clear();
+		file.seekg(0);
+	}
+
 	while (getline(file, line)) {
-		struct people people;
+		const char *p   = line.c_str();
+		const char *end = p + line.length();
+		const char *c;
 
-		auto pos = line.find_first_of(";");
-		if (pos == std::string::npos)
+		c = (const char *)memchr(p, ';', end - p);
+		if (!c)
 			continue;
 
-		auto path = line.substr(0, pos);
-		line = line.substr(pos + 1);
+		walk_path(std::string(p, c - p), walk, true);
 
-		while (line.length() > 0) {
-			std::string token;
+		// The rest of the line are name:count pairs separated by ';'
+		scores.clear();
+		for (p = c + 1; p < end; p = c + 1) {
+			const char *colon;
 
-			pos = line.find_first_of(";");
-			if (pos != std::string::npos) {
-				token = line.substr(0, pos);
-				line = line.substr(pos + 1);
-			} else {
-				token = line;
-				line = "";
-			}
+			c = (const char *)memchr(p, ';', end - p);
+			if (!c)
+				c = end;
 
-			pos = token.find_first_of(":");
-			if (pos == std::string::npos)
+			colon = (const char *)memchr(p, ':', c - p);
+			if (!colon)
 				continue;
 
-			auto name  = token.substr(0, pos);
-			auto count = token.substr(pos + 1);
-
-			struct person p;
-
-			p.name = name;
-			p.count = atoi(count.c_str());
+			add_score(scores, intern(std::string(p, colon - p)),
+				  atoi(colon + 1));
+		}
 
-			people.add_one(p);
+		if (!compact) {
+			path_map[walk.back().first].scores = scores;
+			path_map[walk.back().first].known  = true;
+			continue;
 		}
 
-		path_map[path] = people;
+		for (auto &w : walk) {
+			for (auto &s : scores)
+				add_score(path_map[w.first].scores, s.id, s.count);
+			path_map[w.first].known = true;
+		}
 	}
 
 	file.close();
@@ -77,28 +262,27 @@ int git_who::load_path_map(std::string filename)
 	return 0;
 }
 
-static int diff_file_cb(const git_diff_delta *delta, float progess, void *data)
-{
-	git_who *w = static_cast<git_who *>(data);
-
-	w->add_path(delta->new_file.path);
-
-	return 0;
-}
-
 void git_who::add_path(std::string path)
 {
 	paths.emplace(std::move(path));
 }
 
-bool git_who::get_paths_from_commit(git_commit *commit, size_t idx)
+/*
+ * Only the names of the changed files are needed, so the deltas of the
+ * tree diff are read directly and no blob content is ever loaded.
+ */
+static bool get_paths_from_commit(git_commit *commit, size_t idx,
+				  std::set<std::string> &paths)
 {
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
 	git_commit *parent;
 	git_tree *a, *b;
 	git_diff *diff;
 	int error;
 	bool ret;
 
+	opts.flags |= GIT_DIFF_SKIP_BINARY_CHECK;
+
 	ret = false;
 	error = git_commit_parent(&parent, commit, 0);
 	if (error)
@@ -112,20 +296,15 @@ bool git_who::get_paths_from_commit(git_commit *commit, size_t idx)
 	if (error)
 		goto out_tree_a;
 
-	error = git_diff_tree_to_tree(&diff, git_commit_owner(commit), a, b, NULL);
+	error = git_diff_tree_to_tree(&diff, git_commit_owner(commit), a, b, &opts);
 	if (error)
 		goto out_tree_b;
 
-#if LIBGIT2_VER_MAJOR == 0 && LIBGIT2_VER_MINOR < 23
-	error = git_diff_foreach(diff, diff_file_cb, NULL, NULL, this);
-#else
-	error = git_diff_foreach(diff, diff_file_cb, NULL, NULL, NULL, this);
-#endif
-	if (error)
-		goto out_diff;
+	for (size_t i = 0; i < git_diff_num_deltas(diff); ++i)
+		paths.emplace(git_diff_get_delta(diff, i)->new_file.path);
 
 	ret = true;
-out_diff:
+
 	git_diff_free(diff);
 
 out_tree_b:
@@ -143,17 +322,25 @@ out:
 
 static int treewalk_cb(const char *root, const git_tree_entry *e, void *data)
 {
-	git_who *w = static_cast<git_who *>(data);
+	std::set<std::string> *paths = static_cast<std::set<std::string> *>(data);
 	std::string path = root;
 
 	path += git_tree_entry_name(e);
-	w->add_path(std::move(path));
+	paths->emplace(std::move(path));
 
 	return 0;
 }
 
 bool git_who::get_paths_from_revision(git_repository *repo, std::string rev)
 {
+	return get_paths_from_revision(repo, rev, paths);
+}
+
+bool git_who::get_paths_from_revision(git_repository *repo,
+				      const std::string &rev,
+				      std::set<std::string> &paths)
+{
+	trace_span span("get_paths");
 	unsigned int parents;
 	git_commit *commit;
 	git_object *obj;
@@ -178,13 +365,13 @@ bool git_who::get_paths_from_revision(git_repository *repo, std::string rev)
 		if (error)
 			goto out_commit_free;
 
-		error = git_tree_walk(tree, GIT_TREEWALK_PRE, treewalk_cb, this);
+		error = git_tree_walk(tree, GIT_TREEWALK_PRE, treewalk_cb, &paths);
 		git_tree_free(tree);
 		if (error)
 			goto out_commit_free;
 	} else {
 		for (unsigned int i = 0; i < parents; ++i) {
-			ret = get_paths_from_commit(commit, i);
+			ret = get_paths_from_commit(commit, i, paths);
 			if (ret)
 				goto out_commit_free;
 		}
@@ -201,78 +388,196 @@ out_obj_free:
 	return ret;
 }
 
-static bool is_prefix(std::string prefix, std::string value)
+/* Compares like std::string::compare() */
+static int compare_name(const char *a, size_t a_len, const char *b, size_t b_len)
 {
-	auto len1 = prefix.length();
-	auto len2 = value.length();
+	int ret = memcmp(a, b, std::min(a_len, b_len));
 
-	if (len1 > len2)
-		return false;
+	if (ret)
+		return ret;
 
-	return (value.substr(0, len1) == prefix);
+	return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
 }
 
-void git_who::match_paths(struct people &results)
+unsigned git_who::child(unsigned node, const char *name, size_t len, bool create)
 {
-	std::set<std::string> prefix_paths, new_paths;
+	if (pm) {
+		const struct pm_node *n = pm_node(map, pm, node);
+		const uint32_t *children;
+		unsigned lo, hi;
+
+		if ((uint64_t)n->first_child + n->nr_children > pm->nr_children)
+			return 0;
+
+		children = reinterpret_cast<const uint32_t *>(map + pm->children_off) +
+			   n->first_child;
+
+		// Binary search over the run of children, they are sorted by name
+		for (lo = 0, hi = n->nr_children; lo < hi;) {
+			unsigned mid = lo + (hi - lo) / 2;
+			const struct pm_node *c;
+			int ret;
+
+			if (!children[mid] || children[mid] >= pm->nr_nodes)
+				return 0;
+
+			c = pm_node(map, pm, children[mid]);
+			if ((uint64_t)c->name + c->name_len > pm->strings_size)
+				return 0;
+
+			ret = compare_name(map + pm->strings_off + c->name,
+					   c->name_len, name, len);
+			if (!ret)
+				return children[mid];
+			else if (ret < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
 
-	// First build a prefix map for unknown paths
-	for (auto path : paths) {
-		auto pos = path_map.find(path);
+		return 0;
+	}
 
-		// We care only about prefixes for unknown paths
-		if (pos != path_map.end())
-			continue;
+	auto &children = path_map[node].children;
+	unsigned idx;
 
-		while (path != "" && pos == path_map.end()) {
-			auto slash = path.find_last_of("/");
-			if (slash == std::string::npos)
-				path = "";
-			else
-				path = path.substr(0, slash);
-			pos = path_map.find(path);
-		}
+	auto it = std::lower_bound(children.begin(), children.end(),
+				   std::make_pair(name, len),
+				   [](const std::pair<std::string, unsigned> &c,
+				      const std::pair<const char *, size_t> &n) {
+					return c.first.compare(0, std::string::npos,
+							       n.first, n.second) < 0;
+				   });
 
-		if (path != "" && pos != path_map.end())
-			prefix_paths.insert(path);
+	if (it != children.end() &&
+	    !it->first.compare(0, std::string::npos, name, len))
+		return it->second;
+
+	if (!create)
+		return 0;
+
+	idx = path_map.size();
+	children.insert(it, std::make_pair(std::string(name, len), idx));
+	path_map.emplace_back();
+
+	return idx;
+}
+
+/*
+ * Looks up every component of path in the trie and stores the nodes in
+ * walk. Returns false when the path is not in the trie, walk then ends
+ * with the last component that was found.
+ */
+bool git_who::walk_path(const std::string &path, path_walk &walk, bool create)
+{
+	const char *p   = path.c_str();
+	const char *end = p + path.length();
+	unsigned node   = 0;
+
+	walk.clear();
+
+	while (true) {
+		const char *c = (const char *)memchr(p, '/', end - p);
+		const char *e = c ? c : end;
+
+		node = child(node, p, e - p, create);
+		if (!node)
+			return false;
+
+		walk.emplace_back(node, e - path.c_str());
+		if (!c)
+			return true;
+
+		p = c + 1;
 	}
+}
 
-	// Copy the prefixes to new_paths
-	new_paths = prefix_paths;
+/*
+ * Paths not in the path-map are replaced by their longest known prefix.
+ * Known paths below any of these prefixes are dropped, they are already
+ * accounted for by the prefix.
+ */
+void git_who::match_paths(struct people &results)
+{
+	match_paths(paths, results);
+}
 
-	// Eliminate paths that have a prefix already stored
-	for (auto path : paths) {
+void git_who::match_paths(const std::set<std::string> &paths,
+			  struct people &results)
+{
+	trace_span span("match_paths");
+	std::map<std::string, unsigned> new_paths;
+	std::vector<std::pair<const std::string *, path_walk> > known_paths;
+	std::set<unsigned> prefixes;
+	path_walk walk;
+
+	for (auto &path : paths) {
+		if (walk_path(path, walk, false) && known(walk.back().first)) {
+			known_paths.emplace_back(&path, walk);
+			continue;
+		}
+
+		// The empty path is never used as a prefix
+		for (auto w = walk.rbegin(); w != walk.rend(); ++w) {
+			if (!known(w->first) || !w->second)
+				continue;
+
+			prefixes.insert(w->first);
+			new_paths[path.substr(0, w->second)] = w->first;
+			break;
+		}
+	}
+
+	for (auto &k : known_paths) {
 		bool store = true;
 
-		for (auto prefix : prefix_paths) {
-			if (is_prefix(prefix, path)) {
+		for (auto &w : k.second) {
+			if (prefixes.find(w.first) != prefixes.end()) {
 				store = false;
 				break;
 			}
 		}
 
-		if (!store)
-			continue;
-
-		auto pos = path_map.find(path);
-		if (pos != path_map.end())
-			new_paths.insert(path);
+		if (store)
+			new_paths[*k.first] = k.second.back().first;
 	}
 
-	// Do the matching
-	for (auto path : new_paths) {
-		auto pos = path_map.find(path);
+	/*
+	 * Sum up the scores, developers are kept in the order first seen.
+	 * Only the developers of the matched paths are touched, not the
+	 * whole name table.
+	 */
+	std::unordered_map<unsigned, size_t> slot;
+	std::vector<std::pair<unsigned, int> > totals;
+	unsigned max_id = nr_names();
+
+	for (auto &path : new_paths) {
+		const struct pm_score *s;
+		unsigned nr;
+
+		s = scores(path.second, nr);
+		for (unsigned i = 0; i < nr; ++i) {
+			if (s[i].id >= max_id)
+				continue;
 
-		if (pos == path_map.end()) {
-			std::cerr << "BUG: Unknown path in new_path set" << std::endl;
-			continue;
-		}
+			auto ret = slot.emplace(s[i].id, totals.size());
+			if (ret.second)
+				totals.emplace_back(s[i].id, 0);
 
-		results = results + pos->second;
+			totals[ret.first->second].second += s[i].count;
+		}
 	}
 
-	// Sort the results
-	std::sort(results.persons.rbegin(), results.persons.rend());
+	// Sort the results, names are only looked up once they are in order
+	std::sort(totals.rbegin(), totals.rend(),
+		  [](const std::pair<unsigned, int> &a,
+		     const std::pair<unsigned, int> &b) {
+			return a.second < b.second;
+		  });
+
+	results.persons.reserve(results.persons.size() + totals.size());
+	for (auto &t : totals)
+		results.persons.push_back({ name(t.first), t.second });
 }
 
 void git_who::reset(void)
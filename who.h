@@ -20,6 +20,8 @@
 
 #include <git2.h>
 
+#include "pathmap.h"
+
 struct person {
 	std::string name;
 	int count;
@@ -32,41 +34,62 @@ struct person {
 
 struct people {
 	std::vector<struct person> persons;
+};
 
-	inline void add_one(const struct person &p)
-	{
-		for (auto &i : persons) {
-			if (p.name == i.name) {
-				i.count += p.count;
-				return;
-			}
-		}
-
-		persons.push_back(p);
-	}
-
-	inline struct people &operator+(const struct people &p)
-	{
-		for (auto &i : p.persons)
-			add_one(i);
+/* A node in the path-map trie, one per path component */
+struct path_entry {
+	std::vector<std::pair<std::string, unsigned> > children;	// Sorted by name
+	std::vector<struct pm_score> scores;	// Ids index git_who::names
+	bool known;
 
-		return *this;
-	}
+	path_entry() : known(false) { }
 };
 
+/* Trie node and end of the component in the path string */
+using path_walk = std::vector<std::pair<unsigned, size_t> >;
+
 class git_who {
 private:
-	std::map<std::string, struct people> path_map;
+	std::vector<struct path_entry> path_map;		// path_map[0] is the root
+	std::vector<std::string> names;
+	std::map<std::string, unsigned> name_ids;
 	std::set<std::string> paths;
 
-	bool get_paths_from_commit(git_commit*, size_t);
+	/* Binary path-map, only mapped into memory and read on demand */
+	const char *map;
+	size_t map_size;
+	const struct pm_header *pm;
+
+	int  map_binary(int, size_t);
+	bool known(unsigned);
+	const struct pm_score *scores(unsigned, unsigned&);
+	const char *name(unsigned);
+	unsigned nr_names(void);
+
+	unsigned child(unsigned, const char*, size_t, bool);
+	bool walk_path(const std::string&, path_walk&, bool);
+	unsigned intern(const std::string&);
 
 public:
+	git_who() : path_map(1), map(NULL), map_size(0), pm(NULL) { }
+	~git_who();
+
+	git_who(const git_who&) = delete;
+	git_who &operator=(const git_who&) = delete;
+
 	void add_path(std::string);
 	int  load_path_map(std::string);
 	void match_paths(struct people &results);
 	bool get_paths_from_revision(git_repository*, std::string);
 	void reset(void);
+
+	/*
+	 * Thread-safe variants working on a caller provided path list, the
+	 * path-map is only read once it is loaded.
+	 */
+	void match_paths(const std::set<std::string>&, struct people&);
+	static bool get_paths_from_revision(git_repository*, const std::string&,
+					    std::set<std::string>&);
 };
 
 #endif /* __WHO_H */